@@ -4,14 +4,32 @@
 //     -I/opt/homebrew/opt/llvm/include/c++/v1 main.cpp -o main
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <numeric>
+#include <optional>
 #include <print>     // std::print, std::println
+#include <random>
+#include <span>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 // noinspection CppUnusedIncludeDirective
@@ -20,28 +38,54 @@
 // noinspection CppUnusedIncludeDirective
 // NOLINTNEXTLINE
 #include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <format>
 #include <iomanip>
 
 // POSIX networking
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// File mapping (analyze), worker processes (--procs) and libzstd (--compress)
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace std::string_view_literals;
 
 static std::mutex g_print_mtx;
 
-#ifdef HAVE_LDNS
-#include <ldns/ldns.h>
-#endif
-
 enum class Family { Any, IPv4, IPv6 };
 
+// One EDNS Client Subnet (RFC 7871) prefix to probe with
+struct EcsSubnet
+{
+    std::string text; // canonical CIDR, e.g. "198.51.100.0/24"
+    std::string wire; // option payload: family, source prefix, scope, address
+};
+
 struct Options
 {
-    std::string host;
+    std::string              host;  // first (or only) host name
+    std::vector<std::string> hosts; // all names, de-duplicated, in input order
+    std::string              hosts_file; // one name per line
+    int                      top_n    = 10;    // slowest hosts to list
+    bool                     per_host = false; // full per-host table (text)
     int         tries  = 3;
     Family      family = Family::Any;
     // detailed controls
@@ -60,7 +104,14 @@ struct Options
     bool             dedup       = false;  // fold duplicate results
     bool             ndjson      = false;  // NDJSON streaming per attempt
     std::vector<int> pctl;                 // requested percentiles (0..100)
-    // Raw DNS (ldns) controls - Phase1
+    std::string      hist_out;             // serialised latency histogram path
+    bool             live = false;         // refreshing terminal dashboard
+    bool             answer_sets = false;  // track distinct answer sets
+    bool             cache_stats = false;  // infer cache hit/miss from TTLs
+    std::string            ecs_file;  // one CIDR per line (--ecs-list)
+    std::string            ecs_range; // CIDR:STEP (--ecs-range)
+    std::vector<EcsSubnet> ecs;       // subnets each host is queried with
+    // Raw DNS controls - Phase1
     std::string qtype;
     // when non-empty, enable raw DNS path (e.g., "A","AAAA","TXT",...)
     std::string ns;                 // server IP/host (authoritative/recursive)
@@ -68,12 +119,45 @@ struct Options
     bool        do_bit     = false; // DNSSEC DO bit in EDNS
     int         timeout_ms = 2000;  // per-attempt timeout
     bool        tcp        = false; // force TCP transport
+    int         edns_size  = 1232;  // advertised EDNS UDP payload size
+    bool        cookie     = false; // send DNS cookies (RFC 7873)
+    bool        nsid       = false; // request NSID (RFC 5001)
+    int         padding    = 0;     // pad queries to this block (RFC 7830)
+    bool        case_0x20  = false; // randomise qname case per attempt
+    int         workers    = 0;     // raw UDP event loops, 0 = one per CPU
+    bool        pin        = false; // pin each raw worker to its own CPU
+    int         busy_poll  = -1;    // -1 off, else SO_BUSY_POLL usec (0: none)
+    // Raw UDP source pool (--source-addrs / --source-ports / --source-order)
+    std::vector<std::string> source_addrs;      // local IPs, empty = any
+    int                      source_port_lo = 0; // 0 = ephemeral ports
+    int                      source_port_hi = 0;
+    bool                     source_hash = false; // by target, else rr
+    int                      procs = 1; // forked worker processes (--procs)
+    // Benchmark steadiness (--warmup / --until-stable)
+    int    warmup_n     = 0;   // first N attempts are warmup
+    double warmup_ms    = 0;   // or those started in the first MS
+    int    stable_pctl  = 0;   // 0 = off, else percentile to watch
+    double stable_width = 5.0; // stop once its 95% CI is this % wide
+    // Throughput/latency sweep (--sweep / --sweep-step)
+    std::vector<int> sweep;                 // step values, empty = off
+    bool             sweep_rate    = false; // rate= steps, else concurrency=
+    double           sweep_step_ms = 5000;  // how long each step runs
+    double           ci_level      = 0;     // bootstrap CI level, 0 = off
+    // Tail capture (--capture-slow / --capture-rest)
+    double capture_ms   = 0;     // fixed threshold, 0 = off
+    int    capture_pctl = 0;     // or the running pN, 0 = off
+    bool   capture_none = false; // no record for the other attempts
+    // NDJSON sampling (--sample F, or 1/N for every Nth attempt)
+    uint64_t sample_below = UINT64_MAX; // line if a 64-bit draw <= this
+    int      sample_every = 0;          // or if the attempt number is a multiple
+    // Output compression (--compress zstd[:level])
+    int compress_level = 0; // zstd level, 0 = off
 };
 
 static void print_usage(const char *prog)
 {
     std::println("DNS resolver / timing tool");
-    std::println("Usage: {} [options] <hostname>", prog);
+    std::println("Usage: {} [options] <hostname> [hostname ...]", prog);
     std::println("Options:");
     std::println(
         "  --tries N          Number of resolution attempts (default: 3)");
@@ -101,18 +185,106 @@ static void print_usage(const char *prog)
         "  --ndjson           Output each attempt as a single JSON line (NDJSON)");
     std::println(
         "  --pctl LIST        Comma-separated percentiles for summary (e.g., 50,90,99)");
+    std::println(
+        "  --ci LEVEL         Bootstrap confidence intervals for avg and --pctl (e.g., 95)");
+    std::println(
+        "  --capture-slow T   NDJSON: full records and raw bytes only for errors and tries");
+    std::println(
+        "                     over T (pN running percentile, or MS); raw mode");
+    std::println(
+        "  --capture-rest R   Record for the other tries: compact (default) or none");
+    std::println(
+        "  --sample F         NDJSON: write a random fraction F of attempt lines, or 1/N for");
+    std::println(
+        "                     every Nth; summaries still count every attempt");
+    std::println(
+        "  --compress zstd[:L]  Compress stdout and --hist-out as zstd frames (level 1..22)");
     std::println("  --dedup            Fold duplicate results per attempt");
     std::println(
-        "  --type RR          Raw DNS mode (ldns): A,AAAA,CNAME,NS,MX,TXT,SOA,CAA,SRV,DS,DNSKEY,PTR");
-    std::println("  --ns SERVER        DNS server to query (IP or host)");
+        "  --hist-out FILE    Write a mergeable latency histogram (see 'merge')");
+    std::println(
+        "  --live             Refreshing dashboard instead of per-try lines");
+    std::println(
+        "  --answer-sets      Summarise distinct answer sets across tries");
+    std::println(
+        "  --cache-stats      Infer cache hits/misses from answer TTLs (raw mode)");
+    std::println(
+        "  --type RR          Raw DNS mode: A,AAAA,CNAME,NS,MX,TXT,SOA,CAA,SRV,DS,DNSKEY,PTR,...,TYPEnnn");
+    std::println(
+        "  --ns SERVER        DNS server to query: IP, IPv4:port or [IPv6]:port");
     std::println("  --rd on|off        Recursion Desired flag (default: on)");
     std::println("  --do on|off        DNSSEC DO flag (default: off)");
     std::println(
         "  --timeout MS       Query timeout in milliseconds (default: 2000)");
     std::println(
         "  --tcp              Force TCP transport (default: UDP with TCP fallback)");
+    std::println(
+        "  --edns-size N      EDNS UDP payload size, 512..65535 (default: 1232)");
+    std::println(
+        "  --cookie           Send DNS cookies, reusing the server cookie per socket");
+    std::println(
+        "  --nsid             Request NSID and group latency by answering instance");
+    std::println(
+        "  --padding N        Pad queries to a multiple of N bytes (e.g., 128)");
+    std::println(
+        "  --0x20             Randomise qname letter case; replies must echo it");
+    std::println(
+        "  --workers N        Raw UDP event-loop workers (default: one per CPU)");
+    std::println(
+        "  --procs N          Split the tries over N forked processes sharing one stats map");
+    std::println(
+        "  --warmup N|DUR     Leave the first N attempts (or e.g. 2s, 500ms) out of the stats");
+    std::println(
+        "  --until-stable[=P[:W]]  Stop once the 95% CI of pP is under W% wide (default 99:5)");
+    std::println(
+        "  --sweep S          Raw UDP steps: concurrency=1,2,4,... or rate=QPS,...; one row each");
+    std::println(
+        "  --sweep-step DUR   How long each --sweep step runs, e.g. 10s (default: 5s)");
+    std::println(
+        "  --pin              Pin each raw UDP worker to its own CPU (Linux)");
+    std::println(
+        "  --busy-poll[=US]   Spin on receive for alternate blocks of tries, compare with");
+    std::println(
+        "                     blocking ones; US also sets SO_BUSY_POLL (Linux); implies --pin");
+    std::println(
+        "  --source-addrs L   Send raw UDP queries from these local IPs (comma-separated)");
+    std::println(
+        "  --source-ports R   ...and from these local ports, e.g. 40000-40063");
+    std::println(
+        "  --source-order O   Pick the source per query: rr (default) or hash (by name)");
+    std::println(
+        "  --ecs-list FILE    Query every host once per client subnet in FILE (raw mode)");
+    std::println(
+        "  --ecs-range C:S    Client subnets of prefix S inside CIDR C, e.g. 10.0.0.0/16:24");
+    std::println(
+        "  --hosts-file FILE  Read additional host names, one per line");
+    std::println(
+        "  --top N            Slowest hosts listed for multi-host runs (default: 10)");
+    std::println(
+        "  --per-host         Print the full per-host table in text mode");
     std::println("  -h, --help         Show this help");
     std::println("");
+    std::println("Subcommands:");
+    std::println(
+        "  {} merge [--pctl LIST] [--json] [--hist-out FILE] FILE.hist ...",
+        prog);
+    std::println(
+        "  {} compare [--pctl LIST] [--json] [--max-regress PCT] [--max-error-delta PP]",
+        prog);
+    std::println(
+        "      [--alpha A] BEFORE AFTER   (.hist, NDJSON or JSON; exit 2 on regression)");
+    std::println(
+        "  {} analyze [--pctl LIST] [--json] [--group-by rc|rcode] [--threads N] FILE.ndjson",
+        prog);
+    std::println(
+        "  {} bench-timers [--count N]   (timer wheel throughput and precision)",
+        prog);
+    std::println(
+        "  {} serve [--listen ADDR:PORT] [--zone FILE] [--threads N] [--batch N]",
+        prog);
+    std::println(
+        "      [--duration S] [--pin] [--quiet]   (built-in UDP responder for benchmarks)");
+    std::println("");
     std::println("Examples:");
     std::println("  {} example.com", prog);
     std::println(
@@ -456,140 +628,5077 @@ static std::string json_escape(std::string_view s)
     return out;
 }
 
-static bool parse_args(int argc, char **argv, Options &opt)
+// Log-linear bucket index: values below 2^SubBits are exact, then every power
+// of two is split into 2^(SubBits-1) linear sub-buckets.
+template <int SubBits>
+static constexpr size_t log_linear_index(uint64_t ns)
 {
-    for (int i = 1; i < argc; ++i)
+    constexpr uint64_t sub_count = uint64_t{1} << SubBits;
+    constexpr uint64_t half      = sub_count / 2;
+    if (ns < sub_count) return ns;
+    int octave = static_cast<int>(std::bit_width(ns)) - SubBits; // >= 1
+    return sub_count + (octave - 1) * half + ((ns >> octave) - half);
+}
+
+// Highest value that maps to bucket idx (HDR "highest equivalent value").
+template <int SubBits>
+static constexpr uint64_t log_linear_highest(size_t idx)
+{
+    constexpr uint64_t sub_count = uint64_t{1} << SubBits;
+    constexpr uint64_t half      = sub_count / 2;
+    if (idx < sub_count) return idx;
+    size_t   octave = (idx - sub_count) / half + 1;
+    uint64_t sub    = (idx - sub_count) % half + half;
+    return ((sub + 1) << octave) - 1;
+}
+
+// --- Compressed output (--compress) ---
+// libzstd is loaded at run time, so the tool builds without its headers and
+// only --compress needs the library. The declarations below are the stable
+// streaming API of zstd >= 1.4.
+struct ZstdInBuf
+{
+    const void *src;
+    size_t      size;
+    size_t      pos;
+};
+
+struct ZstdOutBuf
+{
+    void * dst;
+    size_t size;
+    size_t pos;
+};
+
+struct ZstdApi
+{
+    static constexpr int kLevel    = 100; // ZSTD_c_compressionLevel
+    static constexpr int kChecksum = 201; // ZSTD_c_checksumFlag
+    static constexpr int kContinue = 0;   // ZSTD_e_continue
+    static constexpr int kEnd      = 2;   // ZSTD_e_end
+    static constexpr int kMaxLevel = 22;
+
+    void *(*create_cctx)();
+    size_t (*free_cctx)(void *);
+    size_t (*set_parameter)(void *, int, int);
+    size_t (*compress_stream2)(void *, ZstdOutBuf *, ZstdInBuf *, int);
+    size_t (*cstream_out_size)();
+    void *(*create_dctx)();
+    size_t (*free_dctx)(void *);
+    size_t (*decompress_stream)(void *, ZstdOutBuf *, ZstdInBuf *);
+    size_t (*dstream_out_size)();
+    unsigned (*is_error)(size_t);
+    const char *(*error_name)(size_t);
+};
+
+static constexpr std::string_view kZstdMagic = "\x28\xb5\x2f\xfd";
+
+// The library, loaded once; nullptr (with the reason in err) if it is not
+// installed.
+static const ZstdApi *zstd_api(std::string *err = nullptr)
+{
+    static std::string   why;
+    static const ZstdApi *api = []() -> const ZstdApi *
     {
-        std::string_view a = argv[i];
-        if (a == "-h"sv || a == "--help"sv)
-        {
-            print_usage(argv[0]);
-            return false;
-        }
-        if (a == "-4"sv)
-        {
-            opt.family = Family::IPv4;
-        }
-        else if (a == "-6"sv)
-        {
-            opt.family = Family::IPv6;
-        }
-        else if (a == "--all"sv)
-        {
-            opt.all = true;
-        }
-        else if (a == "--v4mapped"sv)
-        {
-            opt.v4mapped = true;
-        }
-        else if (a == "--numeric-host"sv)
-        {
-            opt.numeric_host = true;
-        }
-        else if (a == "--addrconfig"sv)
+        void *lib = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (!lib)
         {
-            opt.addrconfig = true;
+            why = dlerror();
+            return nullptr;
         }
-        else if (a == "--no-addrconfig"sv)
+        static ZstdApi a;
+        bool           ok   = true;
+        auto           bind = [&](auto &fn, const char *name)
         {
-            opt.addrconfig = false;
-        }
-        else if (a == "--canonname"sv)
+            fn = reinterpret_cast<std::remove_reference_t<decltype(fn)>>(
+                dlsym(lib, name));
+            if (!fn && ok)
+            {
+                why = std::format("libzstd.so.1 lacks {}", name);
+                ok  = false;
+            }
+        };
+        bind(a.create_cctx, "ZSTD_createCCtx");
+        bind(a.free_cctx, "ZSTD_freeCCtx");
+        bind(a.set_parameter, "ZSTD_CCtx_setParameter");
+        bind(a.compress_stream2, "ZSTD_compressStream2");
+        bind(a.cstream_out_size, "ZSTD_CStreamOutSize");
+        bind(a.create_dctx, "ZSTD_createDCtx");
+        bind(a.free_dctx, "ZSTD_freeDCtx");
+        bind(a.decompress_stream, "ZSTD_decompressStream");
+        bind(a.dstream_out_size, "ZSTD_DStreamOutSize");
+        bind(a.is_error, "ZSTD_isError");
+        bind(a.error_name, "ZSTD_getErrorName");
+        return ok ? &a : nullptr;
+    }();
+    if (!api && err) *err = why;
+    return api;
+}
+
+// "zstd" or "zstd:LEVEL", LEVEL 1..22 (default 3)
+static bool parse_compress(std::string_view val, int &level)
+{
+    if (val == "zstd")
+    {
+        level = 3;
+        return true;
+    }
+    if (!val.starts_with("zstd:")) return false;
+    auto rc = std::from_chars(val.data() + 5, val.data() + val.size(), level);
+    return rc.ec == std::errc() && rc.ptr == val.data() + val.size() &&
+           level >= 1 && level <= ZstdApi::kMaxLevel;
+}
+
+static void *zstd_cctx(const ZstdApi &z, int level)
+{
+    void *cctx = z.create_cctx();
+    if (cctx)
+    {
+        z.set_parameter(cctx, ZstdApi::kLevel, level);
+        z.set_parameter(cctx, ZstdApi::kChecksum, 1);
+    }
+    return cctx;
+}
+
+// One whole frame, for small files such as --hist-out
+static bool zstd_compress(std::string_view in, int level, std::string &out)
+{
+    const ZstdApi *z = zstd_api();
+    void *         cctx = z ? zstd_cctx(*z, level) : nullptr;
+    if (!cctx) return false;
+    std::vector<char> buf(z->cstream_out_size());
+    ZstdInBuf         zin{in.data(), in.size(), 0};
+    size_t            left = 0;
+    do
+    {
+        ZstdOutBuf zout{buf.data(), buf.size(), 0};
+        left = z->compress_stream2(cctx, &zout, &zin, ZstdApi::kEnd);
+        out.append(buf.data(), zout.pos);
+    } while (left && !z->is_error(left));
+    z->free_cctx(cctx);
+    return !z->is_error(left);
+}
+
+// Any number of concatenated frames
+static bool zstd_decompress(std::string_view in, std::string &out)
+{
+    const ZstdApi *z    = zstd_api();
+    void *         dctx = z ? z->create_dctx() : nullptr;
+    if (!dctx) return false;
+    std::vector<char> buf(z->dstream_out_size());
+    ZstdInBuf         zin{in.data(), in.size(), 0};
+    size_t            left = 0;
+    // A full output buffer may hold back more of the same input
+    for (bool full = false; zin.pos < zin.size || full;)
+    {
+        ZstdOutBuf zout{buf.data(), buf.size(), 0};
+        left = z->decompress_stream(dctx, &zout, &zin);
+        if (z->is_error(left)) break;
+        out.append(buf.data(), zout.pos);
+        full = zout.pos == zout.size;
+    }
+    z->free_dctx(dctx);
+    return !z->is_error(left) && left == 0;
+}
+
+// With --compress, stdout is a pipe drained by a writer thread that
+// compresses onto the real stdout. Workers keep writing plain lines into
+// the pipe, which holds at most 1 MiB: compression never runs on a
+// measuring thread and buffering stays bounded. A frame is closed every
+// 4 MiB of input or after a second, so an interrupted or still-running
+// output decompresses up to its last complete frame. --procs children
+// inherit the pipe and are drained by the parent's thread.
+struct StdoutCompressor
+{
+    static constexpr size_t kChunk      = size_t{128} << 10;
+    static constexpr size_t kFrameBytes = size_t{4} << 20;
+
+    const ZstdApi *z       = nullptr;
+    void *         cctx    = nullptr;
+    int            out_fd  = -1; // the original stdout
+    int            pipe_rd = -1;
+    pid_t          owner   = 0;
+    std::string    error;
+    std::thread    writer;
+
+    bool start(int level)
+    {
+        z = zstd_api(&error);
+        if (!z) return false;
+        if (isatty(STDOUT_FILENO))
         {
-            opt.canonname = true;
+            error = "refusing to write compressed data to a terminal";
+            return false;
         }
-        else if (a == "--no-canonname"sv)
+        cctx = zstd_cctx(*z, level);
+        int fds[2];
+        if (!cctx || pipe(fds) != 0)
         {
-            opt.canonname = false;
+            error = cctx ? std::strerror(errno) : "ZSTD_createCCtx failed";
+            return false;
         }
-        else if (a.rfind("--family", 0) == 0)
+        for (int fd: fds) fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+        fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+#endif
+        std::fflush(stdout);
+        out_fd  = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        pipe_rd = fds[0];
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        owner  = getpid();
+        writer = std::thread([this] { run(); });
+        return true;
+    }
+
+    // Flush, hand the real stdout back and wait for the last frame
+    void finish()
+    {
+        if (!writer.joinable() || getpid() != owner) return;
+        std::fflush(stdout);
+        dup2(out_fd, STDOUT_FILENO);
+        writer.join();
+        close(out_fd);
+        close(pipe_rd);
+        z->free_cctx(cctx);
+        if (!error.empty())
+            std::println(stderr, "--compress: {}", error);
+    }
+
+    ~StdoutCompressor() { finish(); }
+
+    bool write_all(const char *p, size_t n)
+    {
+        while (n)
         {
-            // starts_with
-            std::string val;
-            if (a == "--family"sv && i + 1 < argc)
-            {
-                val = argv[++i];
-            }
-            else if (a.size() > 9 && a.substr(8, 1) == "="sv)
-            {
-                val = std::string(a.substr(9));
-            }
-            else
-            {
-                std::println("invalid --family usage");
-                return false;
-            }
-            if (val == "any") opt.family = Family::Any;
-            else if (val == "inet") opt.family = Family::IPv4;
-            else if (val == "inet6") opt.family = Family::IPv6;
-            else
+            ssize_t w = write(out_fd, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0)
             {
-                std::println("unknown family: {}", val);
+                error = std::strerror(errno);
                 return false;
             }
+            p += w;
+            n -= static_cast<size_t>(w);
         }
-        else if (a.rfind("--service", 0) == 0)
+        return true;
+    }
+
+    bool feed(ZstdInBuf &zin, int op, std::vector<char> &buf)
+    {
+        for (;;)
         {
-            if (a == "--service"sv && i + 1 < argc)
-            {
-                opt.service = argv[++i];
-            }
-            else if (a.size() > 10 && a.substr(9, 1) == "="sv)
-            {
-                opt.service = std::string(a.substr(10));
-            }
-            else
+            ZstdOutBuf zout{buf.data(), buf.size(), 0};
+            size_t     left = z->compress_stream2(cctx, &zout, &zin, op);
+            if (z->is_error(left))
             {
-                std::println("invalid --service usage");
+                error = z->error_name(left);
                 return false;
             }
+            if (!write_all(buf.data(), zout.pos)) return false;
+            if (op == ZstdApi::kEnd ? left == 0 : zin.pos == zin.size) return true;
         }
-        else if (a.rfind("--socktype", 0) == 0)
+    }
+
+    void run()
+    {
+        std::vector<char> in(kChunk), out(z->cstream_out_size());
+        size_t            frame_in = 0;
+        auto              frame_t0 = std::chrono::steady_clock::now();
+        bool              ok       = true;
+        while (ok)
         {
-            std::string val;
-            if (a == "--socktype"sv && i + 1 < argc) val = argv[++i];
-            else if (a.size() > 11 && a.substr(10, 1) ==
-                     "="sv)
-                val = std::string(a.substr(11));
-            else
+            int wait = -1;
+            if (frame_in)
+                wait = std::max<int>(
+                    0,
+                    1000 - static_cast<int>(
+                        std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - frame_t0).count()));
+            pollfd pfd{pipe_rd, POLLIN, 0};
+            int    pr = poll(&pfd, 1, wait);
+            if (pr < 0 && errno == EINTR) continue;
+            if (pr > 0)
             {
-                std::println("invalid --socktype usage");
-                return false;
+                ssize_t n = read(pipe_rd, in.data(), in.size());
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                if (!frame_in) frame_t0 = std::chrono::steady_clock::now();
+                frame_in += static_cast<size_t>(n);
+                ZstdInBuf zin{in.data(), static_cast<size_t>(n), 0};
+                ok = feed(zin, ZstdApi::kContinue, out);
             }
-            if (val == "stream") opt.socktype = SOCK_STREAM;
-            else if (val == "dgram") opt.socktype = SOCK_DGRAM;
-            else if (val == "raw") opt.socktype = SOCK_RAW;
-            else if (val == "any") opt.socktype = 0;
-            else
+            if (ok && frame_in &&
+                (frame_in >= kFrameBytes ||
+                 std::chrono::steady_clock::now() - frame_t0 >=
+                     std::chrono::seconds(1)))
             {
-                std::println("unknown socktype: {}", val);
-                return false;
+                ZstdInBuf none{nullptr, 0, 0};
+                ok       = feed(none, ZstdApi::kEnd, out);
+                frame_in = 0;
             }
         }
-        else if (a.rfind("--protocol", 0) == 0)
+        if (ok && frame_in)
         {
-            std::string val;
-            if (a == "--protocol"sv && i + 1 < argc) val = argv[++i];
-            else if (a.size() > 11 && a.substr(10, 1) ==
-                     "="sv)
-                val = std::string(a.substr(11));
-            else
-            {
-                std::println("invalid --protocol usage");
-                return false;
-            }
-            if (val == "tcp") opt.protocol = IPPROTO_TCP;
-            else if (val == "udp") opt.protocol = IPPROTO_UDP;
-            else if (val == "any") opt.protocol = 0;
-            else
-            {
-                std::println("unknown protocol: {}", val);
-                return false;
-            }
+            ZstdInBuf none{nullptr, 0, 0};
+            feed(none, ZstdApi::kEnd, out);
         }
-        else if (a == "--reverse"sv || a == "--ptr"sv)
+        // Keep draining after a failure, so writers never block on the pipe
+        while (read(pipe_rd, in.data(), in.size()) > 0) {}
+    }
+};
+
+// --- Latency histogram (HDR-style log-linear buckets, nanosecond unit) ---
+// Values below kSubCount ns are exact; above that each power-of-two range is
+// split into kHalf linear sub-buckets, so the relative error stays below
+// 1/kHalf (~1.6%). Merging is a plain per-bucket add, so percentiles of merged
+// histograms equal percentiles of the combined raw samples at this resolution.
+struct LatencyHistogram
+{
+    static constexpr int      kSubBits  = 7;
+    static constexpr uint64_t kSubCount = uint64_t{1} << kSubBits;
+    static constexpr uint64_t kHalf     = kSubCount / 2;
+    static constexpr int      kOctaves  = 34; // up to 2^41 ns (~36 min)
+    static constexpr size_t   kBuckets  = kSubCount + kOctaves * kHalf;
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(kBuckets, 0);
+    uint64_t              total  = 0;
+    uint64_t              errors = 0; // attempts with rc != 0
+    uint64_t              min_ns = UINT64_MAX;
+    uint64_t              max_ns = 0;
+    uint64_t              sum_ns = 0;
+
+    static size_t index_of(uint64_t ns)
+    {
+        return std::min(log_linear_index<kSubBits>(ns), kBuckets - 1);
+    }
+
+    static uint64_t highest_of(size_t idx)
+    {
+        return log_linear_highest<kSubBits>(idx);
+    }
+
+    void record_ns(uint64_t ns, bool error)
+    {
+        ++counts[index_of(ns)];
+        ++total;
+        if (error) ++errors;
+        min_ns = std::min(min_ns, ns);
+        max_ns = std::max(max_ns, ns);
+        sum_ns += ns;
+    }
+
+    void record(double ms, bool error)
+    {
+        record_ns(static_cast<uint64_t>(std::llround(std::max(ms, 0.0) * 1e6)),
+                  error);
+    }
+
+    void merge(const LatencyHistogram &o)
+    {
+        for (size_t i = 0; i < kBuckets; ++i) counts[i] += o.counts[i];
+        total += o.total;
+        errors += o.errors;
+        min_ns = std::min(min_ns, o.min_ns);
+        max_ns = std::max(max_ns, o.max_ns);
+        sum_ns += o.sum_ns;
+    }
+
+    [[nodiscard]] double min_ms() const
+    {
+        return total ? static_cast<double>(min_ns) / 1e6 : 0.0;
+    }
+
+    [[nodiscard]] double max_ms() const
+    {
+        return static_cast<double>(max_ns) / 1e6;
+    }
+
+    [[nodiscard]] double avg_ms() const
+    {
+        return total
+                   ? static_cast<double>(sum_ns) / 1e6 / static_cast<double>(
+                         total)
+                   : 0.0;
+    }
+
+    // Nearest-rank percentile, same rank rule as the raw-sample summary.
+    [[nodiscard]] double pct_ms(int p) const
+    {
+        if (total == 0) return 0;
+        uint64_t pc = static_cast<uint64_t>(std::clamp(p, 0, 100));
+        return rank_ms(std::clamp<uint64_t>((pc * total + 99) / 100, 1, total));
+    }
+
+    // Value of the rank-th smallest sample (1-based) at bucket resolution
+    [[nodiscard]] double rank_ms(uint64_t rank) const
+    {
+        uint64_t acc = 0;
+        for (size_t i = 0; i < kBuckets; ++i)
         {
-            opt.reverse = true;
+            acc += counts[i];
+            if (acc >= rank)
+                return static_cast<double>(std::clamp(
+                           highest_of(i),
+                           min_ns,
+                           max_ns)) / 1e6;
+        }
+        return max_ms();
+    }
+};
+
+// Serialised form: "WQH1", then LEB128 varints: sub_bits, total, errors,
+// min_ns, max_ns, sum_ns, number of non-empty buckets, and (index delta,
+// count) pairs for those buckets. A typical run fits in a few hundred bytes.
+static constexpr std::string_view kHistMagic = "WQH1";
+
+static void put_varint(std::string &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+static bool get_varint(std::string_view &in, uint64_t &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && !in.empty(); shift += 7)
+    {
+        auto b = static_cast<unsigned char>(in.front());
+        in.remove_prefix(1);
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static std::string hist_serialize(const LatencyHistogram &h)
+{
+    std::string out(kHistMagic);
+    put_varint(out, LatencyHistogram::kSubBits);
+    put_varint(out, h.total);
+    put_varint(out, h.errors);
+    put_varint(out, h.total ? h.min_ns : 0);
+    put_varint(out, h.max_ns);
+    put_varint(out, h.sum_ns);
+    uint64_t nz = std::ranges::count_if(h.counts, [](uint64_t c) { return c; });
+    put_varint(out, nz);
+    size_t prev = 0;
+    for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i)
+    {
+        if (!h.counts[i]) continue;
+        put_varint(out, i - prev);
+        put_varint(out, h.counts[i]);
+        prev = i;
+    }
+    return out;
+}
+
+static bool hist_deserialize(std::string_view in, LatencyHistogram &h)
+{
+    if (!in.starts_with(kHistMagic)) return false;
+    in.remove_prefix(kHistMagic.size());
+    uint64_t sub_bits = 0, nz = 0;
+    if (!get_varint(in, sub_bits) || sub_bits != LatencyHistogram::kSubBits)
+        return false;
+    if (!get_varint(in, h.total) || !get_varint(in, h.errors) ||
+        !get_varint(in, h.min_ns) || !get_varint(in, h.max_ns) ||
+        !get_varint(in, h.sum_ns) || !get_varint(in, nz))
+        return false;
+    if (!h.total) h.min_ns = UINT64_MAX;
+    std::ranges::fill(h.counts, 0);
+    size_t idx = 0;
+    for (uint64_t k = 0; k < nz; ++k)
+    {
+        uint64_t delta = 0, c = 0;
+        if (!get_varint(in, delta) || !get_varint(in, c)) return false;
+        idx += delta;
+        if (idx >= LatencyHistogram::kBuckets) return false;
+        h.counts[idx] = c;
+    }
+    return true;
+}
+
+// zstd_level > 0 writes one zstd frame (--compress); reading takes either
+static bool hist_write_file(const std::string &     path,
+                            const LatencyHistogram &h,
+                            int                     zstd_level = 0)
+{
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    std::string bytes = hist_serialize(h);
+    if (zstd_level)
+    {
+        std::string packed;
+        if (!zstd_compress(bytes, zstd_level, packed)) return false;
+        bytes.swap(packed);
+    }
+    f.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(f);
+}
+
+static bool hist_read_file(const std::string &path, LatencyHistogram &h)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    std::string bytes{
+        std::istreambuf_iterator<char>(f),
+        std::istreambuf_iterator<char>()
+    };
+    if (bytes.starts_with(kZstdMagic))
+    {
+        std::string plain;
+        if (!zstd_decompress(bytes, plain)) return false;
+        bytes.swap(plain);
+    }
+    return hist_deserialize(bytes, h);
+}
+
+// Parse "50,90,99" into a sorted, de-duplicated list of percentiles.
+static bool parse_pctl_list(std::string_view val, std::vector<int> &pctl)
+{
+    std::vector<int> out;
+    std::string      num;
+    auto             flush = [&]() -> bool
+    {
+        if (num.empty()) return true;
+        try
+        {
+            int p = std::stoi(num);
+            if (p < 0 || p > 100)
+            {
+                std::println("percentile out of range: {}", p);
+                return false;
+            }
+            out.push_back(p);
+        }
+        catch (...)
+        {
+            std::println("invalid percentile: {}", num);
+            return false;
+        }
+        num.clear();
+        return true;
+    };
+    for (char ch: val)
+    {
+        if (ch == ',')
+        {
+            if (!flush()) return false;
+        }
+        else if (ch >= '0' && ch <= '9')
+        {
+            num.push_back(ch);
+        }
+        else
+        {
+            std::println("invalid --pctl character: {}", std::string(1, ch));
+            return false;
+        }
+    }
+    if (!flush()) return false;
+    std::ranges::sort(out);
+    out.erase(std::ranges::unique(out).begin(), out.end());
+    pctl = std::move(out);
+    return true;
+}
+
+static void print_hist_summary(const LatencyHistogram &h,
+                               const std::vector<int> &pctl)
+{
+    std::println(
+        "summary: min={:.3f} ms, avg={:.3f} ms, max={:.3f} ms ({} tries)",
+        h.min_ms(),
+        h.avg_ms(),
+        h.max_ms(),
+        h.total);
+    std::println("errors: {} ({:.3f}%)",
+                 h.errors,
+                 h.total
+                     ? 100.0 * static_cast<double>(h.errors) / static_cast<
+                           double>(h.total)
+                     : 0.0);
+    if (!pctl.empty())
+    {
+        std::ostringstream os;
+        os << "percentiles:";
+        for (size_t i = 0; i < pctl.size(); ++i)
+        {
+            if (i) os << ',';
+            os << " p" << pctl[i] << '=' << std::fixed << std::setprecision(3)
+                    << h.pct_ms(pctl[i]);
+        }
+        std::println("{}", os.str());
+    }
+}
+
+static void print_hist_json(const LatencyHistogram &h,
+                            const std::vector<int> &pctl,
+                            std::ostringstream &    os)
+{
+    os << R"("summary":{"min_ms":)" << h.min_ms() << ",\"avg_ms\":" << h.
+            avg_ms() << ",\"max_ms\":" << h.max_ms() << ",\"count\":" << h.total
+            << ",\"errors\":" << h.errors << "}";
+    if (!pctl.empty())
+    {
+        os << ",\"percentiles\":{";
+        for (size_t i = 0; i < pctl.size(); ++i)
+        {
+            if (i) os << ",";
+            os << "\"p" << pctl[i] << "\":" << h.pct_ms(pctl[i]);
+        }
+        os << "}";
+    }
+}
+
+// --- Bootstrap confidence intervals (--ci) ---
+// Resamples are drawn from the latency histogram rather than the raw
+// samples, as a Poisson bootstrap: each non-empty bucket's count in a
+// resample is Poisson with the bucket's count as its mean, so a resample
+// costs one draw per bucket however many tries the run had. Buckets with
+// large counts draw from the normal approximation instead, which is far
+// cheaper than a Poisson rejection sampler and no less accurate there.
+// Resamples are handed out in fixed chunks with their own seeds, so the
+// interval does not depend on how many threads ran them.
+struct BootstrapCi
+{
+    double                                 level     = 0; // e.g. 95
+    int                                    resamples = 0;
+    std::pair<double, double>              mean;
+    std::vector<std::pair<double, double>> pctl; // as the --pctl list
+};
+
+static BootstrapCi bootstrap_ci(const LatencyHistogram &h,
+                                const std::vector<int> &pctl,
+                                double                  level,
+                                int                     resamples = 2000)
+{
+    BootstrapCi ci;
+    ci.level     = level;
+    ci.resamples = resamples;
+    ci.pctl.resize(pctl.size());
+    if (h.total == 0) return ci;
+    std::vector<uint64_t> counts;
+    std::vector<double>   value; // bucket value, as rank_ms reports it
+    for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i)
+    {
+        if (!h.counts[i]) continue;
+        counts.push_back(h.counts[i]);
+        value.push_back(static_cast<double>(std::clamp(
+                            LatencyHistogram::highest_of(i),
+                            h.min_ns,
+                            h.max_ns)) / 1e6);
+    }
+    double bucket_mean = 0;
+    for (size_t b = 0; b < counts.size(); ++b)
+        bucket_mean += static_cast<double>(counts[b]) * value[b];
+    bucket_mean /= static_cast<double>(h.total);
+
+    // means[r], and stats[k][r] for percentile k, of resample r
+    std::vector<double>              means(resamples);
+    std::vector<std::vector<double>> stats(pctl.size(),
+                                           std::vector<double>(resamples));
+    constexpr int    kChunk = 64;
+    std::atomic<int> next_chunk{0};
+    auto             work = [&]
+    {
+        constexpr uint64_t                               kNormalFrom = 1000;
+        std::vector<uint64_t>                            draw(counts.size());
+        std::vector<std::poisson_distribution<uint64_t>> dist;
+        std::normal_distribution<double>                 unit;
+        for (uint64_t cnt: counts) // (the normal buckets' are never used)
+            dist.emplace_back(static_cast<double>(std::min(cnt, kNormalFrom)));
+        for (int c = next_chunk.fetch_add(1); c * kChunk < resamples;
+             c = next_chunk.fetch_add(1))
+        {
+            std::mt19937_64 rng(0x9e3779b97f4a7c15ULL * (c + 1));
+            for (int r = c * kChunk; r < std::min(resamples, (c + 1) * kChunk); ++r)
+            {
+                uint64_t n   = 0;
+                double   sum = 0;
+                for (size_t b = 0; b < counts.size(); ++b)
+                {
+                    const auto mean = static_cast<double>(counts[b]);
+                    draw[b] = counts[b] < kNormalFrom
+                                  ? dist[b](rng)
+                                  : static_cast<uint64_t>(std::max(
+                                      0.0,
+                                      std::round(mean + std::sqrt(mean) * unit(rng))));
+                    n += draw[b];
+                    sum += static_cast<double>(draw[b]) * value[b];
+                }
+                // An empty resample (tiny runs only) repeats the data
+                if (!n)
+                {
+                    draw = counts;
+                    n    = h.total;
+                    sum  = bucket_mean * static_cast<double>(n);
+                }
+                means[r] = sum / static_cast<double>(n);
+                // --pctl is sorted, so one cumulative pass serves every rank
+                uint64_t acc = 0;
+                size_t   b   = 0;
+                for (size_t k = 0; k < pctl.size(); ++k)
+                {
+                    uint64_t pc   = static_cast<uint64_t>(std::clamp(pctl[k], 0, 100));
+                    uint64_t rank = std::clamp<uint64_t>((pc * n + 99) / 100, 1, n);
+                    while (acc + draw[b] < rank) acc += draw[b++];
+                    stats[k][r] = value[b];
+                }
+            }
+        }
+    };
+    const int threads = static_cast<int>(std::min<unsigned>(
+        std::max(1u, std::thread::hardware_concurrency()),
+        (resamples + kChunk - 1) / kChunk));
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) pool.emplace_back(work);
+    work();
+    for (auto &th: pool) th.join();
+
+    // Percentile interval; the mean's is shifted by the bucketing error, so
+    // it sits around the exact mean rather than the bucketed one
+    auto interval = [&](std::vector<double> &v)
+    {
+        std::ranges::sort(v);
+        const double tail = (100 - level) / 200;
+        auto         at   = [&](double q)
+        {
+            return v[std::min(v.size() - 1,
+                              static_cast<size_t>(q * static_cast<double>(v.size())))];
+        };
+        return std::pair{at(tail), at(1 - tail)};
+    };
+    ci.mean = interval(means);
+    ci.mean.first += h.avg_ms() - bucket_mean;
+    ci.mean.second += h.avg_ms() - bucket_mean;
+    for (size_t k = 0; k < pctl.size(); ++k) ci.pctl[k] = interval(stats[k]);
+    return ci;
+}
+
+static void print_ci_summary(const BootstrapCi &ci, const std::vector<int> &pctl)
+{
+    std::string line = std::format("{:g}% CI: avg [{:.3f}, {:.3f}]",
+                                   ci.level,
+                                   ci.mean.first,
+                                   ci.mean.second);
+    for (size_t k = 0; k < pctl.size(); ++k)
+        line += std::format(", p{} [{:.3f}, {:.3f}]",
+                            pctl[k],
+                            ci.pctl[k].first,
+                            ci.pctl[k].second);
+    std::println("{} ms ({} bootstrap resamples)", line, ci.resamples);
+}
+
+static void print_ci_json(const BootstrapCi &      ci,
+                          const std::vector<int> &pctl,
+                          std::ostringstream &    os)
+{
+    os << R"("ci":{"level":)" << std::format("{:g}", ci.level) <<
+            ",\"resamples\":" << ci.resamples <<
+            ",\"avg_ms\":[" << ci.mean.first << ',' << ci.mean.second << ']';
+    for (size_t k = 0; k < pctl.size(); ++k)
+        os << ",\"p" << pctl[k] << "\":[" << ci.pctl[k].first << ',' <<
+                ci.pctl[k].second << ']';
+    os << '}';
+}
+
+// wireq merge [--pctl LIST] [--json] [--hist-out FILE] a.hist b.hist ...
+// Files are folded into one accumulator one at a time, so memory stays at two
+// histograms regardless of how many hosts contributed.
+static int run_merge(const char *prog, int argc, char **argv)
+{
+    std::vector<int>         pctl{50, 90, 99};
+    bool                     json = false;
+    std::string              out_path;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view a = argv[i];
+        if (a == "--pctl"sv && i + 1 < argc)
+        {
+            if (!parse_pctl_list(argv[++i], pctl)) return 1;
+        }
+        else if (a.starts_with("--pctl="))
+        {
+            if (!parse_pctl_list(a.substr(7), pctl)) return 1;
+        }
+        else if (a == "--json"sv)
+        {
+            json = true;
+        }
+        else if (a == "--hist-out"sv && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (a.starts_with("--hist-out="))
+        {
+            out_path = std::string(a.substr(11));
+        }
+        else if (!a.empty() && a[0] == '-')
+        {
+            std::println("unknown option: {}", a);
+            return 1;
+        }
+        else
+        {
+            files.emplace_back(a);
+        }
+    }
+    if (files.empty())
+    {
+        std::println(
+            "Usage: {} merge [--pctl LIST] [--json] [--hist-out FILE] FILE.hist ...",
+            prog);
+        return 1;
+    }
+
+    LatencyHistogram acc;
+    LatencyHistogram one;
+    for (const auto &f: files)
+    {
+        if (!hist_read_file(f, one))
+        {
+            std::println("cannot read histogram: {}", f);
+            return 1;
+        }
+        acc.merge(one);
+    }
+    if (!out_path.empty() && !hist_write_file(out_path, acc))
+    {
+        std::println("cannot write histogram: {}", out_path);
+        return 1;
+    }
+    if (json)
+    {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(3);
+        os << "{\"files\":" << files.size() << ",";
+        print_hist_json(acc, pctl, os);
+        os << "}";
+        std::print("{}\n", os.str());
+    }
+    else
+    {
+        std::println("merged: {} file(s)", files.size());
+        print_hist_summary(acc, pctl);
+    }
+    return 0;
+}
+
+enum class ScanResult { Ok, Incomplete, Bad };
+
+// Parse one {"try":N,"ms":X,"rc":R attempt record starting at pos (which
+// points at '{'). Both NDJSON lines and the aggregate JSON "attempts" array
+// emit these three keys first and in this order, followed directly by
+// "warmup":true on --warmup attempts, which the run left out of its stats.
+static ScanResult scan_attempt_record(std::string_view s,
+                                      size_t &         pos,
+                                      double &         ms,
+                                      int &            rc,
+                                      bool &           warmup)
+{
+    static constexpr std::string_view kTry    = R"({"try":)";
+    static constexpr std::string_view kMs     = R"(,"ms":)";
+    static constexpr std::string_view kRc     = R"(,"rc":)";
+    static constexpr std::string_view kWarmup = R"(,"warmup":true)";
+    size_t                            p       = pos + kTry.size();
+    while (p < s.size() && s[p] >= '0' && s[p] <= '9') ++p;
+    if (p + kMs.size() > s.size()) return ScanResult::Incomplete;
+    if (s.substr(p, kMs.size()) != kMs) return ScanResult::Bad;
+    p += kMs.size();
+    auto [ms_end, ms_ec] = std::from_chars(s.data() + p, s.data() + s.size(),
+                                           ms);
+    if (ms_ec != std::errc{} || ms_end == s.data() + s.size())
+        return ms_end == s.data() + s.size()
+                   ? ScanResult::Incomplete
+                   : ScanResult::Bad;
+    p = static_cast<size_t>(ms_end - s.data());
+    if (p + kRc.size() > s.size()) return ScanResult::Incomplete;
+    if (s.substr(p, kRc.size()) != kRc) return ScanResult::Bad;
+    p += kRc.size();
+    auto [rc_end, rc_ec] = std::from_chars(s.data() + p, s.data() + s.size(),
+                                           rc);
+    if (rc_end == s.data() + s.size()) return ScanResult::Incomplete;
+    if (rc_ec != std::errc{}) return ScanResult::Bad;
+    pos                   = static_cast<size_t>(rc_end - s.data());
+    std::string_view rest = s.substr(pos, kWarmup.size());
+    if (rest.size() < kWarmup.size() && kWarmup.starts_with(rest))
+        return ScanResult::Incomplete;
+    warmup = rest == kWarmup;
+    return ScanResult::Ok;
+}
+
+// Load a latency distribution from a .hist file, NDJSON output or aggregate
+// JSON output, leaving out --warmup attempts as the run did. Result files are streamed in fixed-size blocks, so arbitrarily
+// large NDJSON logs are reduced to one histogram without buffering them.
+static bool load_latency_source(const std::string &path, LatencyHistogram &h)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    char head[4]{};
+    f.read(head, sizeof(head));
+    if (f.gcount() == sizeof(head) &&
+        (std::string_view(head, sizeof(head)) == kHistMagic ||
+         std::string_view(head, sizeof(head)) == kZstdMagic))
+    {
+        f.close();
+        return hist_read_file(path, h);
+    }
+    f.clear();
+    f.seekg(0);
+
+    static constexpr std::string_view kTry = R"({"try":)";
+    static constexpr size_t           kBlock = size_t{1} << 20;
+    std::string                       buf;
+    std::vector<char>                 block(kBlock);
+    while (f)
+    {
+        f.read(block.data(), static_cast<std::streamsize>(block.size()));
+        buf.append(block.data(), static_cast<size_t>(f.gcount()));
+        bool   eof   = !f;
+        size_t pos   = 0;
+        size_t carry = std::string::npos;
+        while ((pos = buf.find(kTry, pos)) != std::string::npos)
+        {
+            double ms   = 0;
+            int    rc   = 0;
+            bool   warm = false;
+            size_t at   = pos;
+            auto   r    = scan_attempt_record(buf, pos, ms, rc, warm);
+            if (r == ScanResult::Incomplete && !eof)
+            {
+                carry = at;
+                break;
+            }
+            if (r == ScanResult::Ok && !warm) h.record(ms, rc != 0);
+            else pos = at + kTry.size();
+        }
+        if (carry == std::string::npos)
+            carry = buf.size() > kTry.size() ? buf.size() - kTry.size() : 0;
+        buf.erase(0, carry);
+    }
+    return true;
+}
+
+// Mann-Whitney U over two histograms, treating each bucket as one tie group.
+// Returns z (positive when `after` tends to be slower) and the two-sided p.
+struct MannWhitney
+{
+    double u_after{};    // U statistic for the `after` sample
+    double z{};
+    double p{};
+    double p_superior{}; // P(after > before) + 0.5 * P(tie)
+};
+
+static MannWhitney mann_whitney(const LatencyHistogram &before,
+                                const LatencyHistogram &after)
+{
+    MannWhitney r{};
+    auto        na = static_cast<double>(before.total);
+    auto        nb = static_cast<double>(after.total);
+    if (na == 0 || nb == 0) return r;
+    double n         = na + nb;
+    double rank_base = 0; // ranks consumed so far
+    double r_after   = 0;
+    double ties      = 0; // sum of t^3 - t over tie groups
+    for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i)
+    {
+        auto a = static_cast<double>(before.counts[i]);
+        auto b = static_cast<double>(after.counts[i]);
+        double t = a + b;
+        if (t == 0) continue;
+        r_after += b * (rank_base + (t + 1) / 2);
+        ties += t * t * t - t;
+        rank_base += t;
+    }
+    r.u_after      = r_after - nb * (nb + 1) / 2;
+    r.p_superior   = r.u_after / (na * nb);
+    double mean    = na * nb / 2;
+    double var     = na * nb / 12 * (n + 1 - ties / (n * (n - 1)));
+    if (var <= 0)
+    {
+        r.p = 1;
+        return r;
+    }
+    double diff = r.u_after - mean;
+    double cc   = diff > 0 ? -0.5 : diff < 0 ? 0.5 : 0; // continuity
+    r.z         = (diff + cc) / std::sqrt(var);
+    r.p         = std::erfc(std::fabs(r.z) / std::sqrt(2.0));
+    return r;
+}
+
+// wireq compare [options] BEFORE AFTER
+// Exit code 2 when AFTER regresses against BEFORE, so it can gate CI.
+static int run_compare(const char *prog, int argc, char **argv)
+{
+    std::vector<int>         pctl{50, 90, 99};
+    bool                     json          = false;
+    double                   max_regress   = 10.0; // % per percentile
+    double                   max_err_delta = 1.0;  // percentage points
+    double                   alpha         = 0.05;
+    std::vector<std::string> files;
+    auto number_arg = [&](int &i, std::string_view name, double &out) -> bool
+    {
+        std::string_view a = argv[i];
+        std::string      val;
+        if (a == name && i + 1 < argc) val = argv[++i];
+        else if (a.size() > name.size() + 1 && a[name.size()] == '=')
+            val = std::string(a.substr(name.size() + 1));
+        else
+        {
+            std::println("invalid {} usage", name);
+            return false;
+        }
+        try { out = std::stod(val); }
+        catch (...)
+        {
+            std::println("invalid {} value: {}", name, val);
+            return false;
+        }
+        return true;
+    };
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view a = argv[i];
+        if (a == "--pctl"sv && i + 1 < argc)
+        {
+            if (!parse_pctl_list(argv[++i], pctl)) return 1;
+        }
+        else if (a.starts_with("--pctl="))
+        {
+            if (!parse_pctl_list(a.substr(7), pctl)) return 1;
+        }
+        else if (a == "--json"sv)
+        {
+            json = true;
+        }
+        else if (a.starts_with("--max-regress"))
+        {
+            if (!number_arg(i, "--max-regress", max_regress)) return 1;
+        }
+        else if (a.starts_with("--max-error-delta"))
+        {
+            if (!number_arg(i, "--max-error-delta", max_err_delta)) return 1;
+        }
+        else if (a.starts_with("--alpha"))
+        {
+            if (!number_arg(i, "--alpha", alpha)) return 1;
+        }
+        else if (!a.empty() && a[0] == '-')
+        {
+            std::println("unknown option: {}", a);
+            return 1;
+        }
+        else
+        {
+            files.emplace_back(a);
+        }
+    }
+    if (files.size() != 2)
+    {
+        std::println(
+            "Usage: {} compare [--pctl LIST] [--json] [--max-regress PCT] "
+            "[--max-error-delta PP] [--alpha A] BEFORE AFTER",
+            prog);
+        return 1;
+    }
+
+    LatencyHistogram before, after;
+    if (!load_latency_source(files[0], before))
+    {
+        std::println("cannot read: {}", files[0]);
+        return 1;
+    }
+    if (!load_latency_source(files[1], after))
+    {
+        std::println("cannot read: {}", files[1]);
+        return 1;
+    }
+    if (before.total == 0 || after.total == 0)
+    {
+        std::println("no attempts found in {}",
+                     before.total == 0 ? files[0] : files[1]);
+        return 1;
+    }
+
+    auto err_rate = [](const LatencyHistogram &h)
+    {
+        return 100.0 * static_cast<double>(h.errors) / static_cast<double>(h.
+                   total);
+    };
+    MannWhitney mw          = mann_whitney(before, after);
+    bool        significant = mw.p < alpha && mw.z > 0;
+    double      err_delta   = err_rate(after) - err_rate(before);
+    std::vector<std::string> reasons;
+    struct Row
+    {
+        int    p;
+        double a, b, delta, pct;
+    };
+    std::vector<Row> rows;
+    for (int p: pctl)
+    {
+        double a   = before.pct_ms(p);
+        double b   = after.pct_ms(p);
+        double pct = a > 0 ? (b - a) / a * 100.0 : 0.0;
+        rows.push_back({p, a, b, b - a, pct});
+        if (significant && pct > max_regress)
+            reasons.push_back(std::format("p{} {:+.1f}% > {:.1f}%",
+                                          p,
+                                          pct,
+                                          max_regress));
+    }
+    if (err_delta > max_err_delta)
+        reasons.push_back(std::format("error rate {:+.3f} pp > {:.3f} pp",
+                                      err_delta,
+                                      max_err_delta));
+    bool regression = !reasons.empty();
+
+    if (json)
+    {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(3);
+        os << R"({"before":{"file":")" << json_escape(files[0]) << "\",";
+        print_hist_json(before, pctl, os);
+        os << R"(},"after":{"file":")" << json_escape(files[1]) << "\",";
+        print_hist_json(after, pctl, os);
+        os << "},\"deltas\":{";
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            if (i) os << ",";
+            os << "\"p" << rows[i].p << R"(":{"ms":)" << rows[i].delta <<
+                    ",\"pct\":" << rows[i].pct << "}";
+        }
+        os << "},\"error_rate_delta_pp\":" << err_delta;
+        os << std::setprecision(6);
+        os << R"(,"mann_whitney":{"u":)" << mw.u_after << ",\"z\":" << mw.z <<
+                ",\"p\":" << mw.p << ",\"p_superior\":" << mw.p_superior <<
+                "}";
+        os << ",\"regression\":" << (regression ? "true" : "false") << "}";
+        std::print("{}\n", os.str());
+    }
+    else
+    {
+        std::println("before: {} ({} tries, {} errors)",
+                     files[0],
+                     before.total,
+                     before.errors);
+        std::println("after:  {} ({} tries, {} errors)",
+                     files[1],
+                     after.total,
+                     after.errors);
+        for (const auto &[p, a, b, delta, pct]: rows)
+            std::println("  p{}: {:.3f} -> {:.3f} ms ({:+.3f} ms, {:+.1f}%)",
+                         p,
+                         a,
+                         b,
+                         delta,
+                         pct);
+        std::println("  avg: {:.3f} -> {:.3f} ms",
+                     before.avg_ms(),
+                     after.avg_ms());
+        std::println("  errors: {:.3f}% -> {:.3f}% ({:+.3f} pp)",
+                     err_rate(before),
+                     err_rate(after),
+                     err_delta);
+        std::println(
+            "  mann-whitney: U={:.1f} z={:.3f} p={:.4g} P(after>before)={:.3f}",
+            mw.u_after,
+            mw.z,
+            mw.p,
+            mw.p_superior);
+        if (regression)
+        {
+            std::string why;
+            for (size_t i = 0; i < reasons.size(); ++i)
+                why += (i ? "; " : "") + reasons[i];
+            std::println("verdict: regression ({})", why);
+        }
+        else
+        {
+            std::println("verdict: ok");
+        }
+    }
+    return regression ? 2 : 0;
+}
+
+enum class GroupBy { None, Rc, Rcode };
+
+static constexpr int kNoGroup = INT32_MIN; // record lacks the group field
+
+// Summarise the NDJSON lines in [begin, end) into per-group histograms,
+// skipping --warmup attempts. Only the leading try/ms/rc triple and, when grouping by it, raw_dns.rcode are
+// looked at; line splitting and key search go through memchr/find, which the
+// C library vectorises.
+static void analyze_chunk(const char *                     begin,
+                          const char *                     end,
+                          GroupBy                          group_by,
+                          std::map<int, LatencyHistogram> &groups,
+                          uint64_t &                       lines)
+{
+    static constexpr std::string_view kTry   = R"({"try":)";
+    static constexpr std::string_view kRcode = R"("rcode":)";
+    const char *                      p      = begin;
+    while (p < end)
+    {
+        const auto *nl = static_cast<const char *>(std::memchr(
+            p,
+            '\n',
+            static_cast<size_t>(end - p)));
+        const char *     line_end = nl ? nl : end;
+        std::string_view line(p, static_cast<size_t>(line_end - p));
+        p = line_end + 1;
+        if (!line.starts_with(kTry)) continue;
+        size_t pos  = 0;
+        double ms   = 0;
+        int    rc   = 0;
+        bool   warm = false;
+        if (scan_attempt_record(line, pos, ms, rc, warm) != ScanResult::Ok ||
+            warm)
+            continue;
+        ++lines;
+        int key = 0;
+        if (group_by == GroupBy::Rc) key = rc;
+        else if (group_by == GroupBy::Rcode)
+        {
+            // Only within this record: [line_end) is where memchr found
+            // its newline
+            key = kNoGroup;
+            std::string_view rest = line.substr(pos);
+            if (size_t at = rest.find(kRcode); at != std::string_view::npos)
+                std::from_chars(rest.data() + at + kRcode.size(), line_end, key);
+        }
+        groups[key].record(ms, rc != 0);
+    }
+}
+
+// wireq analyze FILE.ndjson [--pctl LIST] [--group-by rc|rcode] [--threads N]
+// The file is mapped read-only and cut at line boundaries into one chunk per
+// thread; per-thread histograms are merged once at the end.
+static int run_analyze(const char *prog, int argc, char **argv)
+{
+    std::vector<int> pctl{50, 90, 99};
+    bool             json     = false;
+    GroupBy          group_by = GroupBy::None;
+    unsigned         threads  = std::max(1u, std::thread::hardware_concurrency());
+    std::string      path;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view a = argv[i];
+        if (a == "--pctl"sv && i + 1 < argc)
+        {
+            if (!parse_pctl_list(argv[++i], pctl)) return 1;
+        }
+        else if (a.starts_with("--pctl="))
+        {
+            if (!parse_pctl_list(a.substr(7), pctl)) return 1;
+        }
+        else if (a == "--json"sv)
+        {
+            json = true;
+        }
+        else if (a.rfind("--group-by", 0) == 0)
+        {
+            std::string val;
+            if (a == "--group-by"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 11 && a.substr(10, 1) == "="sv)
+                val = std::string(a.substr(11));
+            else
+            {
+                std::println("invalid --group-by usage");
+                return 1;
+            }
+            if (val == "rc") group_by = GroupBy::Rc;
+            else if (val == "rcode") group_by = GroupBy::Rcode;
+            else if (val == "none") group_by = GroupBy::None;
+            else
+            {
+                std::println("unknown --group-by key: {}", val);
+                return 1;
+            }
+        }
+        else if (a.rfind("--threads", 0) == 0)
+        {
+            std::string val;
+            if (a == "--threads"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 10 && a.substr(9, 1) == "="sv)
+                val = std::string(a.substr(10));
+            else
+            {
+                std::println("invalid --threads usage");
+                return 1;
+            }
+            try { threads = static_cast<unsigned>(std::max(1, std::stoi(val))); }
+            catch (...)
+            {
+                std::println("invalid --threads value: {}", val);
+                return 1;
+            }
+        }
+        else if (!a.empty() && a[0] == '-')
+        {
+            std::println("unknown option: {}", a);
+            return 1;
+        }
+        else
+        {
+            path = std::string(a);
+        }
+    }
+    if (path.empty())
+    {
+        std::println(
+            "Usage: {} analyze [--pctl LIST] [--json] [--group-by rc|rcode] "
+            "[--threads N] FILE.ndjson",
+            prog);
+        return 1;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::println("cannot open: {}", path);
+        return 1;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        std::println("cannot stat: {}", path);
+        return 1;
+    }
+    auto        size = static_cast<size_t>(st.st_size);
+    const char *data = nullptr;
+    if (size)
+    {
+        void *m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED)
+        {
+            close(fd);
+            std::println("cannot map: {}", path);
+            return 1;
+        }
+        madvise(m, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(m);
+    }
+
+    // Chunk boundaries, each advanced to just past the next newline
+    threads = static_cast<unsigned>(std::clamp<size_t>(
+        threads,
+        1,
+        std::max<size_t>(1, size >> 16)));
+    std::vector<const char *> cuts{data};
+    for (unsigned k = 1; k < threads; ++k)
+    {
+        const char *c = data + size * k / threads;
+        if (c < cuts.back()) c = cuts.back();
+        const auto *nl = static_cast<const char *>(std::memchr(
+            c,
+            '\n',
+            static_cast<size_t>(data + size - c)));
+        cuts.push_back(nl ? nl + 1 : data + size);
+    }
+    cuts.push_back(data + size);
+
+    std::vector<std::map<int, LatencyHistogram>> part(threads);
+    std::vector<uint64_t>                        part_lines(threads, 0);
+    {
+        std::vector<std::thread> pool;
+        pool.reserve(threads);
+        for (unsigned k = 0; k < threads; ++k)
+            pool.emplace_back([&, k]
+            {
+                analyze_chunk(cuts[k], cuts[k + 1], group_by, part[k],
+                              part_lines[k]);
+            });
+        for (auto &th: pool) th.join();
+    }
+    if (data) munmap(const_cast<char *>(data), size);
+    close(fd);
+
+    std::map<int, LatencyHistogram> groups;
+    LatencyHistogram                all;
+    uint64_t                        lines = 0;
+    for (unsigned k = 0; k < threads; ++k)
+    {
+        lines += part_lines[k];
+        for (const auto &[key, h]: part[k])
+        {
+            groups[key].merge(h);
+            all.merge(h);
+        }
+    }
+    if (lines == 0)
+    {
+        std::println("no attempts found in {}", path);
+        return 1;
+    }
+
+    const char *key_name = group_by == GroupBy::Rc ? "rc" : "rcode";
+    auto        key_str  = [](int key)
+    {
+        return key == kNoGroup ? std::string("none") : std::to_string(key);
+    };
+    if (json)
+    {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(3);
+        os << R"({"file":")" << json_escape(path) << R"(","lines":)" << lines
+                << ",";
+        print_hist_json(all, pctl, os);
+        if (group_by != GroupBy::None)
+        {
+            os << R"(,"group_by":")" << key_name << R"(","groups":{)";
+            bool first = true;
+            for (const auto &[key, h]: groups)
+            {
+                if (!first) os << ",";
+                first = false;
+                os << "\"" << key_str(key) << "\":{";
+                print_hist_json(h, pctl, os);
+                os << "}";
+            }
+            os << "}";
+        }
+        os << "}";
+        std::print("{}\n", os.str());
+    }
+    else
+    {
+        std::println("analyzed: {} ({} attempts, {} thread(s))",
+                     path,
+                     lines,
+                     threads);
+        print_hist_summary(all, pctl);
+        if (group_by != GroupBy::None)
+        {
+            for (const auto &[key, h]: groups)
+            {
+                std::ostringstream os;
+                os << std::fixed << std::setprecision(3);
+                os << "  " << key_name << '=' << key_str(key) << ": " << h.total
+                        << " tries, min=" << h.min_ms() << " avg=" << h.avg_ms()
+                        << " max=" << h.max_ms();
+                for (int p: pctl) os << " p" << p << '=' << h.pct_ms(p);
+                std::println("{}", os.str());
+            }
+        }
+    }
+    return 0;
+}
+
+// --- Per-worker statistics shards ---
+// Each worker owns one shard and is its only writer, so updates are plain
+// relaxed load/store pairs rather than locked read-modify-writes. Readers (the
+// live view, the final summary) may observe slightly stale values.
+struct alignas(64) StatsShard
+{
+    static constexpr size_t kRcodeSlots = 17; // DNS rcode 0..15, [16] = error
+    static constexpr size_t kErrorSlot  = 16;
+
+    // Inline rather than on the heap, so shards can live in a shared mapping
+    std::array<std::atomic<uint64_t>, LatencyHistogram::kBuckets> counts{};
+    std::array<std::atomic<uint64_t>, kRcodeSlots> results{};
+    std::atomic<uint64_t> done{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> inflight{0};
+    std::atomic<uint64_t> min_ns{UINT64_MAX};
+    std::atomic<uint64_t> max_ns{0};
+    std::atomic<uint64_t> sum_ns{0};
+
+    static void set(std::atomic<uint64_t> &a, uint64_t v)
+    {
+        a.store(v, std::memory_order_relaxed);
+    }
+
+    static uint64_t get(const std::atomic<uint64_t> &a)
+    {
+        return a.load(std::memory_order_relaxed);
+    }
+
+    // rcode: DNS rcode of a raw reply, or -1 when there is none
+    void record(double ms, bool error, int rcode)
+    {
+        auto ns = static_cast<uint64_t>(std::llround(std::max(ms, 0.0) * 1e6));
+        auto &c = counts[LatencyHistogram::index_of(ns)];
+        set(c, get(c) + 1);
+        size_t slot = error
+                          ? kErrorSlot
+                          : static_cast<size_t>(std::clamp(rcode, 0, 15));
+        set(results[slot], get(results[slot]) + 1);
+        if (error) set(errors, get(errors) + 1);
+        set(min_ns, std::min(get(min_ns), ns));
+        set(max_ns, std::max(get(max_ns), ns));
+        set(sum_ns, get(sum_ns) + ns);
+        set(done, get(done) + 1);
+    }
+
+    // Back to empty, between --sweep steps while the worker is parked
+    void reset()
+    {
+        for (auto &c: counts) set(c, 0);
+        for (auto &r: results) set(r, 0);
+        for (auto *a: {&done, &errors, &inflight, &max_ns, &sum_ns}) set(*a, 0);
+        set(min_ns, UINT64_MAX);
+    }
+
+    // Add this shard into a plain histogram
+    void snapshot(LatencyHistogram &h) const
+    {
+        for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i)
+            h.counts[i] += get(counts[i]);
+        h.total += get(done);
+        h.errors += get(errors);
+        h.min_ns = std::min(h.min_ns, get(min_ns));
+        h.max_ns = std::max(h.max_ns, get(max_ns));
+        h.sum_ns += get(sum_ns);
+    }
+};
+
+static const char *rcode_str(size_t rcode)
+{
+    static constexpr const char *kNames[] = {
+        "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+        "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE",
+    };
+    return rcode < std::size(kNames) ? kNames[rcode] : "RCODE";
+}
+
+// Label of a StatsShard::results slot
+static std::string result_label(size_t slot, bool raw)
+{
+    if (slot == StatsShard::kErrorSlot) return "error";
+    if (!raw) return "ok";
+    std::string label = rcode_str(slot);
+    if (label == "RCODE") label += std::to_string(slot);
+    return label;
+}
+
+// --- Multi-process runs (--procs) ---
+// The parent maps one anonymous shared region before forking: a counter
+// block per process, then every process's stats shards. Each child runs the
+// usual worker threads over its slice of the try range and writes only its
+// own shards, just as threads do within one process, so nothing crosses a
+// process boundary on the hot path. The parent reads the shards for --live
+// and folds them into the summary once the children have exited.
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shared stats need address-free atomics");
+
+struct alignas(64) ProcCounters
+{
+    std::atomic<uint64_t> udp_sockets{0};
+    std::atomic<uint64_t> stray{0};
+};
+
+struct SharedStats
+{
+    int           procs    = 0;
+    int           workers  = 0; // per process
+    void *        base     = MAP_FAILED;
+    size_t        bytes    = 0;
+    ProcCounters *counters = nullptr; // [procs]
+    StatsShard *  shards   = nullptr; // [procs * workers], process-major
+
+    SharedStats(int p, int w) : procs(p), workers(w)
+    {
+        bytes = sizeof(ProcCounters) * static_cast<size_t>(p) +
+                sizeof(StatsShard) * static_cast<size_t>(p * w);
+        base = mmap(nullptr,
+                    bytes,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS,
+                    -1,
+                    0);
+        if (base == MAP_FAILED) return;
+        counters = new(base) ProcCounters[static_cast<size_t>(p)];
+        shards   = new(counters + p) StatsShard[static_cast<size_t>(p * w)];
+    }
+
+    SharedStats(const SharedStats &)            = delete;
+    SharedStats &operator=(const SharedStats &) = delete;
+    ~SharedStats() { if (base != MAP_FAILED) munmap(base, bytes); }
+
+    [[nodiscard]] bool ok() const { return base != MAP_FAILED; }
+
+    [[nodiscard]] std::span<StatsShard> of(int proc) const
+    {
+        return {shards + proc * workers, static_cast<size_t>(workers)};
+    }
+
+    [[nodiscard]] std::span<const StatsShard> all() const
+    {
+        return {shards, static_cast<size_t>(procs * workers)};
+    }
+};
+
+// Merged summary of a --procs run, from the shared shards alone
+static void print_procs_summary(const Options &    opt,
+                                const SharedStats &ss,
+                                bool               raw_async)
+{
+    LatencyHistogram                              hist;
+    std::array<uint64_t, StatsShard::kRcodeSlots> results{};
+    for (const auto &shard: ss.all())
+    {
+        shard.snapshot(hist);
+        for (size_t i = 0; i < results.size(); ++i)
+            results[i] += StatsShard::get(shard.results[i]);
+    }
+    uint64_t sockets = 0, stray = 0;
+    for (int p = 0; p < ss.procs; ++p)
+    {
+        sockets += StatsShard::get(ss.counters[p].udp_sockets);
+        stray += StatsShard::get(ss.counters[p].stray);
+    }
+    const bool raw = !opt.qtype.empty();
+    if (opt.json)
+    {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(3);
+        os << R"({"host":")" << json_escape(opt.host) << R"(","tries":)" <<
+                opt.tries << ",\"procs\":" << ss.procs << ",\"workers\":" <<
+                ss.workers << ",";
+        print_hist_json(hist, opt.pctl, os);
+        if (opt.ci_level)
+        {
+            os << ',';
+            print_ci_json(bootstrap_ci(hist, opt.pctl, opt.ci_level), opt.pctl, os);
+        }
+        os << ",\"results\":{";
+        bool first = true;
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            if (!results[i]) continue;
+            os << (first ? "" : ",") << "\"" << result_label(i, raw) << "\":" <<
+                    results[i];
+            first = false;
+        }
+        os << "}";
+        if (raw_async)
+            os << ",\"udp_sockets\":" << sockets << ",\"stray_replies\":" <<
+                    stray;
+        os << "}";
+        std::print("{}\n", os.str());
+        return;
+    }
+    std::println("procs: {} processes x {} workers (merged from shared shards)",
+                 ss.procs,
+                 ss.workers);
+    std::string line = "results:";
+    for (size_t i = 0; i < results.size(); ++i)
+        if (results[i])
+            line += std::format(" {}={}", result_label(i, raw), results[i]);
+    std::println("{}", line);
+    if (raw_async)
+        std::println("udp sockets: {}, stray replies dropped: {}",
+                     sockets,
+                     stray);
+    print_hist_summary(hist, opt.pctl);
+    if (opt.ci_level)
+        print_ci_summary(bootstrap_ci(hist, opt.pctl, opt.ci_level), opt.pctl);
+}
+
+// --- Per-host summaries for multi-host runs ---
+// A host keeps two counters, a latency sum and a sparse, coarse log-linear
+// histogram (8 sub-buckets per power of two, <= 12.5% bucket width) holding
+// only the buckets it has hit. A name tried a handful of times costs well
+// under 100 bytes, so a million names stay in the low hundreds of MB.
+struct HostStats
+{
+    static constexpr int kSubBits = 4;
+
+    uint32_t                                   count  = 0;
+    uint32_t                                   errors = 0;
+    uint64_t                                   sum_ns = 0;
+    std::vector<std::pair<uint16_t, uint32_t>> buckets; // sorted by index
+
+    void record(double ms, bool error)
+    {
+        auto ns  = static_cast<uint64_t>(std::llround(std::max(ms, 0.0) * 1e6));
+        auto idx = static_cast<uint16_t>(log_linear_index<kSubBits>(ns));
+        auto it  = std::ranges::lower_bound(buckets,
+                                           idx,
+                                           {},
+                                           &std::pair<uint16_t, uint32_t>::first);
+        if (it != buckets.end() && it->first == idx) ++it->second;
+        else buckets.insert(it, {idx, 1});
+        ++count;
+        if (error) ++errors;
+        sum_ns += ns;
+    }
+
+    [[nodiscard]] double pct_ms(int p) const
+    {
+        if (count == 0) return 0;
+        uint64_t pc   = static_cast<uint64_t>(std::clamp(p, 0, 100));
+        uint64_t rank = std::clamp<uint64_t>((pc * count + 99) / 100, 1, count);
+        uint64_t acc  = 0;
+        for (const auto &[idx, c]: buckets)
+        {
+            acc += c;
+            if (acc >= rank)
+                return static_cast<double>(log_linear_highest<kSubBits>(idx)) /
+                       1e6;
+        }
+        return 0;
+    }
+
+    [[nodiscard]] double avg_ms() const
+    {
+        return count
+                   ? static_cast<double>(sum_ns) / 1e6 / static_cast<double>(
+                         count)
+                   : 0.0;
+    }
+};
+
+// Host names are de-duplicated when the run starts, so stats are a dense
+// table indexed by host id. Workers hitting the same host serialise on one
+// of kStripes mutexes; different hosts rarely contend.
+struct HostTable
+{
+    static constexpr size_t kStripes = 64;
+
+    std::vector<HostStats>            hosts;
+    std::array<std::mutex, kStripes> locks;
+
+    explicit HostTable(size_t n) : hosts(n) {}
+
+    void record(size_t host, double ms, bool error)
+    {
+        std::scoped_lock lk(locks[host % kStripes]);
+        hosts[host].record(ms, error);
+    }
+
+    // Host ids ordered by descending p99 (then avg), at most n of them
+    [[nodiscard]] std::vector<size_t> slowest(size_t n) const
+    {
+        std::vector<size_t> ids(hosts.size());
+        std::iota(ids.begin(), ids.end(), size_t{0});
+        n = std::min(n, ids.size());
+        std::vector<double> p99(hosts.size());
+        for (size_t i = 0; i < hosts.size(); ++i) p99[i] = hosts[i].pct_ms(99);
+        std::partial_sort(ids.begin(),
+                          ids.begin() + static_cast<std::ptrdiff_t>(n),
+                          ids.end(),
+                          [&](size_t a, size_t b)
+                          {
+                              if (p99[a] != p99[b]) return p99[a] > p99[b];
+                              return hosts[a].avg_ms() > hosts[b].avg_ms();
+                          });
+        ids.resize(n);
+        return ids;
+    }
+};
+
+// Read one entry (host name, subnet) per line; blank lines and '#' comments
+// are skipped.
+static bool load_list_file(const std::string &path, std::vector<std::string> &out)
+{
+    std::ifstream f(path);
+    if (!f) return false;
+    std::string line;
+    while (std::getline(f, line))
+    {
+        auto b = line.find_first_not_of(" \t\r");
+        if (b == std::string::npos || line[b] == '#') continue;
+        auto e = line.find_last_not_of(" \t\r");
+        out.push_back(line.substr(b, e - b + 1));
+    }
+    return true;
+}
+
+// --- Answer-set consistency (--answer-sets) ---
+// An address is keyed by its family byte followed by the raw in_addr/in6_addr
+// bytes. A set is the sorted, de-duplicated concatenation of its addresses,
+// prefixed with the target id (host, plus subnet in ECS runs), and lives in a
+// hash map, so memory grows with the number of distinct sets, not with the
+// number of tries.
+struct AnswerSets
+{
+    std::unordered_map<std::string, uint64_t> sets;      // canonical -> tries
+    std::unordered_map<std::string, uint64_t> addresses; // address -> tries
+    uint64_t                                  tries = 0; // answered tries
+
+    void record(uint32_t host, std::vector<std::string> &addrs)
+    {
+        std::ranges::sort(addrs);
+        addrs.erase(std::ranges::unique(addrs).begin(), addrs.end());
+        std::string key(reinterpret_cast<const char *>(&host), sizeof(host));
+        for (const auto &a: addrs)
+        {
+            key += a;
+            ++addresses[a];
+        }
+        ++sets[key];
+        ++tries;
+    }
+
+    void merge(const AnswerSets &o)
+    {
+        for (const auto &[k, c]: o.sets) sets[k] += c;
+        for (const auto &[k, c]: o.addresses) addresses[k] += c;
+        tries += o.tries;
+    }
+};
+
+static std::string addr_key(int af, const void *raw)
+{
+    std::string k(1, static_cast<char>(af == AF_INET6 ? 6 : 4));
+    k.append(static_cast<const char *>(raw), af == AF_INET6 ? 16 : 4);
+    return k;
+}
+
+static std::string addr_key_str(std::string_view k)
+{
+    char buf[INET6_ADDRSTRLEN]{};
+    inet_ntop(k[0] == 6 ? AF_INET6 : AF_INET, k.data() + 1, buf, sizeof(buf));
+    return buf;
+}
+
+// Split a canonical set key back into host id and printable addresses
+static std::pair<uint32_t, std::vector<std::string>> answer_set_members(
+    std::string_view key)
+{
+    uint32_t host = 0;
+    std::memcpy(&host, key.data(), sizeof(host));
+    key.remove_prefix(sizeof(host));
+    std::vector<std::string> out;
+    while (!key.empty())
+    {
+        size_t len = key[0] == 6 ? 17 : 5;
+        out.push_back(addr_key_str(key.substr(0, len)));
+        key.remove_prefix(len);
+    }
+    return {host, out};
+}
+
+static constexpr size_t kAnswerSetsShown = 20;
+
+static void print_answer_sets(const AnswerSets &              a,
+                              const std::vector<std::string> &targets)
+{
+    std::vector<std::pair<std::string_view, uint64_t>> sets(a.sets.begin(),
+        a.sets.end());
+    std::ranges::sort(sets, std::greater{}, &std::pair<std::string_view, uint64_t>::second);
+    std::println("answer sets: {} distinct over {} answered tries",
+                 sets.size(),
+                 a.tries);
+    for (size_t i = 0; i < sets.size() && i < kAnswerSetsShown; ++i)
+    {
+        auto [host, members] = answer_set_members(sets[i].first);
+        std::string list;
+        for (size_t k = 0; k < members.size(); ++k)
+            list += (k ? ", " : "") + members[k];
+        std::println("  {}{} ({:.1f}%) {{{}}}",
+                     targets.size() > 1 ? "[" + targets[host] + "] " : "",
+                     sets[i].second,
+                     100.0 * static_cast<double>(sets[i].second) /
+                     static_cast<double>(a.tries),
+                     list);
+    }
+    if (sets.size() > kAnswerSetsShown)
+        std::println("  ... {} more", sets.size() - kAnswerSetsShown);
+    std::vector<std::pair<std::string_view, uint64_t>> addrs(
+        a.addresses.begin(),
+        a.addresses.end());
+    std::ranges::sort(addrs, std::greater{}, &std::pair<std::string_view, uint64_t>::second);
+    std::println("address appearance:");
+    for (const auto &[k, c]: addrs)
+        std::println("  {}  {:.1f}%",
+                     addr_key_str(k),
+                     100.0 * static_cast<double>(c) / static_cast<double>(a.
+                         tries));
+}
+
+static void print_answer_sets_json(const AnswerSets &              a,
+                                   const std::vector<std::string> &targets,
+                                   std::string_view                label,
+                                   std::ostringstream &            os)
+{
+    os << R"("answer_sets":{"distinct":)" << a.sets.size() << ",\"tries\":" <<
+            a.tries << ",\"sets\":[";
+    bool first = true;
+    for (const auto &[key, count]: a.sets)
+    {
+        auto [host, members] = answer_set_members(key);
+        if (!first) os << ",";
+        first = false;
+        os << "{";
+        if (targets.size() > 1)
+            os << "\"" << label << R"(":")" << json_escape(targets[host]) <<
+                    "\",";
+        os << "\"count\":" << count << ",\"addresses\":[";
+        for (size_t k = 0; k < members.size(); ++k)
+            os << (k ? "," : "") << "\"" << members[k] << "\"";
+        os << "]}";
+    }
+    os << "],\"addresses\":{";
+    first = true;
+    for (const auto &[k, c]: a.addresses)
+    {
+        if (!first) os << ",";
+        first = false;
+        os << "\"" << addr_key_str(k) << "\":" << static_cast<double>(c) /
+                static_cast<double>(a.tries);
+    }
+    os << "}}";
+}
+
+// --- EDNS options (--cookie / --nsid / --padding) ---
+static constexpr uint16_t kEdnsNsid         = 3;
+static constexpr uint16_t kEdnsClientSubnet = 8;
+static constexpr uint16_t kEdnsCookie       = 10;
+static constexpr uint16_t kEdnsPadding      = 12;
+static constexpr size_t   kClientCookieLen  = 8;
+static constexpr size_t   kServerCookieMin  = 8; // RFC 7873: 8 to 32 bytes
+static constexpr size_t   kServerCookieMax  = 32;
+
+// NSID payloads are usually short ASCII host names; fall back to hex
+static std::string nsid_text(const uint8_t *data, size_t len)
+{
+    bool printable = len > 0;
+    for (size_t i = 0; i < len && printable; ++i)
+        printable = data[i] >= 0x20 && data[i] < 0x7f;
+    if (printable) return {reinterpret_cast<const char *>(data), len};
+    std::string out;
+    for (size_t i = 0; i < len; ++i) out += std::format("{:02x}", data[i]);
+    return out;
+}
+
+// Bytes of padding payload that bring a query of query_len bytes (including
+// the padding option header) to a multiple of block
+static size_t padding_len(size_t query_len, int block)
+{
+    auto b = static_cast<size_t>(block);
+    return (b - query_len % b) % b;
+}
+
+// --- Raw DNS transport and lazy reply view ---
+// Replies land in the worker's receive buffer and are never copied out.
+// ReplyView checks the header and the echoed question in place; the RR
+// sections are only walked when some output needs them, and names and RDATA
+// are handed out as offsets/spans into that buffer.
+static constexpr size_t kMaxMessage = 65535;
+
+struct RrView
+{
+    size_t                   owner = 0; // offset of the (maybe compressed) name
+    uint16_t                 type  = 0;
+    uint16_t                 cls   = 0;
+    uint32_t                 ttl   = 0;
+    std::span<const uint8_t> rdata;
+};
+
+enum class Section : unsigned char { Answer, Authority, Additional };
+
+static constexpr uint16_t kFlagAa = 0x0400;
+static constexpr uint16_t kFlagTc = 0x0200;
+static constexpr uint16_t kFlagRd = 0x0100;
+static constexpr uint16_t kFlagRa = 0x0080;
+static constexpr uint16_t kFlagAd = 0x0020;
+static constexpr uint16_t kFlagCd = 0x0010;
+
+static std::span<const uint8_t> wire_bytes(const std::string &s)
+{
+    return {reinterpret_cast<const uint8_t *>(s.data()), s.size()};
+}
+
+// Offset just past the name at off, or npos if it runs off the message
+static size_t skip_name(std::span<const uint8_t> m, size_t off)
+{
+    while (off < m.size())
+    {
+        uint8_t len = m[off];
+        if ((len & 0xc0) == 0xc0) return off + 2 <= m.size() ? off + 2 : std::string_view::npos;
+        if (len & 0xc0) return std::string_view::npos;
+        off += 1 + len;
+        if (len == 0) return off <= m.size() ? off : std::string_view::npos;
+    }
+    return std::string_view::npos;
+}
+
+// Presentation form of the name at off, following compression pointers
+static std::string name_text(std::span<const uint8_t> m, size_t off)
+{
+    std::string out;
+    for (int hops = 0; off < m.size() && hops < 64;)
+    {
+        uint8_t len = m[off];
+        if ((len & 0xc0) == 0xc0)
+        {
+            if (off + 1 >= m.size()) break;
+            off = static_cast<size_t>(len & 0x3f) << 8 | m[off + 1];
+            ++hops;
+            continue;
+        }
+        if (len == 0 || off + 1 + len > m.size()) break;
+        for (size_t i = off + 1; i <= off + len; ++i)
+        {
+            auto c = static_cast<char>(m[i]);
+            if (c == '.' || c == '\\' || c == '"') out += '\\';
+            if (m[i] < 0x21 || m[i] > 0x7e) out += std::format("\\{:03}", m[i]);
+            else out += c;
+        }
+        out += '.';
+        off += 1 + len;
+    }
+    return out.empty() ? "." : out;
+}
+
+static uint16_t get_u16(std::span<const uint8_t> m, size_t off)
+{
+    return static_cast<uint16_t>(m[off] << 8 | m[off + 1]);
+}
+
+static uint32_t get_u32(std::span<const uint8_t> m, size_t off)
+{
+    return static_cast<uint32_t>(get_u16(m, off)) << 16 | get_u16(m, off + 2);
+}
+
+struct ReplyView
+{
+    std::span<const uint8_t> msg;
+    size_t                   sections[3] = {}; // offsets, valid once indexed
+    bool                     indexed     = false;
+
+    [[nodiscard]] uint16_t id() const { return get_u16(msg, 0); }
+    [[nodiscard]] uint16_t flags() const { return get_u16(msg, 2); }
+    [[nodiscard]] int rcode() const { return flags() & 0x0f; }
+    [[nodiscard]] bool flag(uint16_t bit) const { return flags() & bit; }
+    [[nodiscard]] uint16_t count(Section s) const
+    {
+        return get_u16(msg, 6 + 2 * static_cast<size_t>(s));
+    }
+
+    // A reply to our query: QR set, our ID, one question, and the question
+    // name, type and class equal to what was sent. With exact_case the name
+    // is compared byte for byte, so a --0x20 case pattern must come back
+    // intact.
+    [[nodiscard]] bool check(std::span<const uint8_t> query,
+                             size_t                   qname_len,
+                             bool                     exact_case) const
+    {
+        if (msg.size() < 12 + qname_len + 4 || !(flags() & 0x8000) ||
+            get_u16(msg, 4) != 1 || id() != get_u16(query, 0))
+            return false;
+        for (size_t i = 12; i < 12 + qname_len + 4; ++i)
+            if (msg[i] != query[i] &&
+                (exact_case || (msg[i] | 0x20) != (query[i] | 0x20) ||
+                 !std::isalpha(static_cast<unsigned char>(msg[i]))))
+                return false;
+        return true;
+    }
+
+    // Find where each RR section starts; false if the message is malformed
+    bool index(size_t qname_len)
+    {
+        if (indexed) return true;
+        size_t off = 12 + qname_len + 4;
+        for (int s = 0; s < 3; ++s)
+        {
+            sections[s] = off;
+            for (uint16_t i = 0; i < count(static_cast<Section>(s)); ++i)
+            {
+                off = skip_name(msg, off);
+                if (off == std::string_view::npos || off + 10 > msg.size())
+                    return false;
+                off += 10 + get_u16(msg, off + 8);
+                if (off > msg.size()) return false;
+            }
+        }
+        return indexed = true;
+    }
+
+    // Visit the RRs of one section (after index())
+    template <class Fn>
+    void each_rr(Section s, Fn &&fn) const
+    {
+        size_t off = sections[static_cast<int>(s)];
+        for (uint16_t i = 0; i < count(s); ++i)
+        {
+            RrView rr;
+            rr.owner = off;
+            off      = skip_name(msg, off);
+            rr.type  = get_u16(msg, off);
+            rr.cls   = get_u16(msg, off + 2);
+            rr.ttl   = get_u32(msg, off + 4);
+            rr.rdata = msg.subspan(off + 10, get_u16(msg, off + 8));
+            off += 10 + rr.rdata.size();
+            fn(rr);
+        }
+    }
+};
+
+static const std::pair<std::string_view, uint16_t> kRrTypes[] = {
+    {"A", 1}, {"NS", 2}, {"CNAME", 5}, {"SOA", 6}, {"PTR", 12},
+    {"HINFO", 13}, {"MX", 15}, {"TXT", 16}, {"AAAA", 28}, {"SRV", 33},
+    {"NAPTR", 35}, {"DNAME", 39}, {"OPT", 41}, {"DS", 43}, {"SSHFP", 44},
+    {"RRSIG", 46}, {"NSEC", 47}, {"DNSKEY", 48}, {"NSEC3", 50},
+    {"NSEC3PARAM", 51}, {"TLSA", 52}, {"CDS", 59}, {"CDNSKEY", 60},
+    {"SVCB", 64}, {"HTTPS", 65}, {"SPF", 99}, {"ANY", 255}, {"URI", 256},
+    {"CAA", 257},
+};
+
+static std::string type_text(uint16_t type)
+{
+    for (const auto &[n, c]: kRrTypes)
+        if (c == type) return std::string(n);
+    return std::format("TYPE{}", type);
+}
+
+static std::string base64(std::span<const uint8_t> d)
+{
+    static constexpr char kAlphabet[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < d.size(); i += 3)
+    {
+        uint32_t v = d[i] << 16;
+        if (i + 1 < d.size()) v |= d[i + 1] << 8;
+        if (i + 2 < d.size()) v |= d[i + 2];
+        out += kAlphabet[v >> 18 & 63];
+        out += kAlphabet[v >> 12 & 63];
+        out += i + 1 < d.size() ? kAlphabet[v >> 6 & 63] : '=';
+        out += i + 2 < d.size() ? kAlphabet[v & 63] : '=';
+    }
+    return out;
+}
+
+static std::string hex_upper(std::span<const uint8_t> d)
+{
+    std::string out;
+    for (uint8_t b: d) out += std::format("{:02X}", b);
+    return out;
+}
+
+// Character-strings of TXT/CAA style RDATA, quoted
+static std::string quoted(std::span<const uint8_t> d)
+{
+    std::string out = "\"";
+    for (uint8_t b: d)
+    {
+        if (b == '"' || b == '\\') out += '\\';
+        if (b < 0x20 || b > 0x7e) out += std::format("\\{:03}", b);
+        else out += static_cast<char>(b);
+    }
+    return out + "\"";
+}
+
+// Zone-file style text of one RR: owner, TTL, class, type and RDATA for the
+// common types, RFC 3597 generic form for the rest
+static std::string rr_text(std::span<const uint8_t> m, const RrView &rr)
+{
+    const auto &d    = rr.rdata;
+    const size_t at  = static_cast<size_t>(d.data() - m.data());
+    std::string  out = std::format("{}\t{}\t{}\t{}\t",
+                                  name_text(m, rr.owner),
+                                  rr.ttl,
+                                  rr.cls == 1
+                                      ? std::string("IN")
+                                      : std::format("CLASS{}", rr.cls),
+                                  type_text(rr.type));
+    char buf[INET6_ADDRSTRLEN]{};
+    switch (rr.type)
+    {
+        case 1:
+        case 28:
+            if (d.size() == (rr.type == 1 ? 4u : 16u))
+                return out + inet_ntop(rr.type == 1 ? AF_INET : AF_INET6,
+                                       d.data(),
+                                       buf,
+                                       sizeof(buf));
+            break;
+        case 2:
+        case 5:
+        case 12:
+        case 39:
+            return out + name_text(m, at);
+        case 15:
+            if (d.size() > 2)
+                return out + std::format("{} {}",
+                                         get_u16(m, at),
+                                         name_text(m, at + 2));
+            break;
+        case 16:
+        case 99:
+        {
+            std::string txt;
+            for (size_t i = 0; i < d.size(); i += 1 + d[i])
+            {
+                if (i + 1 + d[i] > d.size()) break;
+                txt += (txt.empty() ? "" : " ") + quoted(d.subspan(i + 1, d[i]));
+            }
+            return out + txt;
+        }
+        case 6:
+        {
+            size_t r = skip_name(m, at);
+            size_t e = r == std::string_view::npos
+                           ? r
+                           : skip_name(m, r);
+            if (e != std::string_view::npos && e + 20 <= at + d.size())
+                return out + std::format("{} {} {} {} {} {} {}",
+                                         name_text(m, at),
+                                         name_text(m, r),
+                                         get_u32(m, e),
+                                         get_u32(m, e + 4),
+                                         get_u32(m, e + 8),
+                                         get_u32(m, e + 12),
+                                         get_u32(m, e + 16));
+            break;
+        }
+        case 33:
+            if (d.size() > 6)
+                return out + std::format("{} {} {} {}",
+                                         get_u16(m, at),
+                                         get_u16(m, at + 2),
+                                         get_u16(m, at + 4),
+                                         name_text(m, at + 6));
+            break;
+        case 43:
+        case 59:
+            if (d.size() > 4)
+                return out + std::format("{} {} {} {}",
+                                         get_u16(m, at),
+                                         d[2],
+                                         d[3],
+                                         hex_upper(d.subspan(4)));
+            break;
+        case 48:
+        case 60:
+            if (d.size() > 4)
+                return out + std::format("{} {} {} {}",
+                                         get_u16(m, at),
+                                         d[2],
+                                         d[3],
+                                         base64(d.subspan(4)));
+            break;
+        case 257:
+            if (d.size() >= 2 && 2u + d[1] <= d.size())
+                return out + std::format(
+                    "{} {} {}",
+                    d[0],
+                    std::string(reinterpret_cast<const char *>(d.data() + 2),
+                                d[1]),
+                    quoted(d.subspan(2 + d[1])));
+            break;
+        default:
+            break;
+    }
+    return out + std::format("\\# {} {}", d.size(), hex_upper(d));
+}
+
+// Name server from --ns ("IP", "IPv4:port", "[IPv6]:port"), or the first
+// nameserver line of /etc/resolv.conf
+static bool resolve_nameserver(const std::string &ns,
+                               sockaddr_storage & out,
+                               socklen_t &        len)
+{
+    std::string spec = ns;
+    if (spec.empty())
+    {
+        std::ifstream f("/etc/resolv.conf");
+        std::string   line;
+        while (std::getline(f, line))
+        {
+            std::istringstream is(line);
+            std::string        key;
+            if (is >> key && key == "nameserver" && is >> spec) break;
+        }
+        if (spec.empty()) spec = "127.0.0.1";
+    }
+    std::string host = spec;
+    uint16_t    port = 53;
+    auto        parse_port = [&](std::string_view p)
+    {
+        auto [e, ec] = std::from_chars(p.data(), p.data() + p.size(), port);
+        return ec == std::errc{} && e == p.data() + p.size() && port != 0;
+    };
+    if (spec.starts_with('['))
+    {
+        auto close = spec.find(']');
+        if (close == std::string::npos) return false;
+        host = spec.substr(1, close - 1);
+        if (close + 1 < spec.size() &&
+            (spec[close + 1] != ':' || !parse_port(
+                 std::string_view(spec).substr(close + 2))))
+            return false;
+    }
+    else if (std::ranges::count(spec, ':') == 1)
+    {
+        host = spec.substr(0, spec.find(':'));
+        if (!parse_port(std::string_view(spec).substr(spec.find(':') + 1)))
+            return false;
+    }
+    out = {};
+    if (auto *v4 = reinterpret_cast<sockaddr_in *>(&out);
+        inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1)
+    {
+        v4->sin_family = AF_INET;
+        v4->sin_port   = htons(port);
+        len            = sizeof(sockaddr_in);
+        return true;
+    }
+    auto *v6 = reinterpret_cast<sockaddr_in6 *>(&out);
+    if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) != 1) return false;
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port   = htons(port);
+    len             = sizeof(sockaddr_in6);
+    return true;
+}
+
+static double ms_left(std::chrono::steady_clock::time_point deadline)
+{
+    return std::chrono::duration<double, std::milli>(
+        deadline - std::chrono::steady_clock::now()).count();
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS: SO_NOSIGPIPE is set on the socket instead
+#endif
+
+// Non-blocking, close-on-exec socket; -1 on failure (errno set)
+static int open_socket(int family, int type)
+{
+    int fd = socket(family, type, 0);
+    if (fd < 0) return -1;
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0 ||
+        fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+    {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    return fd;
+}
+
+// Pin the calling thread to the n-th CPU it may run on (wrapping around);
+// false where affinity is unsupported or the call fails
+static bool pin_to_cpu(int n)
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+    int want = n % std::max(1, CPU_COUNT(&allowed));
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &allowed) || want-- > 0) continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        return pthread_setaffinity_np(pthread_self(), sizeof(one), &one) == 0;
+    }
+#else
+    (void) n;
+#endif
+    return false;
+}
+
+// Wait for fd to become ready; false on timeout (timeout_ms 0 waits forever)
+static bool wait_fd(int                                   fd,
+                    short                                 events,
+                    int                                   timeout_ms,
+                    std::chrono::steady_clock::time_point deadline)
+{
+    pollfd p{fd, events, 0};
+    while (true)
+    {
+        int wait = timeout_ms ? std::max(0, static_cast<int>(std::ceil(
+                                                 ms_left(deadline))))
+                              : -1;
+        int r = poll(&p, 1, wait);
+        if (r > 0) return true;
+        if (r == 0 || errno != EINTR) return false;
+    }
+}
+
+// Wait on fds until one is ready or until (no deadline: indefinitely).
+// Linux waits with nanosecond resolution so sub-millisecond timers are not
+// rounded up to the next millisecond.
+static int poll_until(std::vector<pollfd> &                               fds,
+                      std::optional<std::chrono::steady_clock::time_point> until)
+{
+    if (!until) return poll(fds.data(), fds.size(), -1);
+    auto left = std::max(std::chrono::nanoseconds(0),
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             *until - std::chrono::steady_clock::now()));
+#ifdef __linux__
+    timespec ts{static_cast<time_t>(left.count() / 1'000'000'000),
+                static_cast<long>(left.count() % 1'000'000'000)};
+    return ppoll(fds.data(), fds.size(), &ts, nullptr);
+#else
+    return poll(fds.data(),
+                fds.size(),
+                static_cast<int>((left.count() + 999'999) / 1'000'000));
+#endif
+}
+
+static bool io_full(int fd, bool out, uint8_t *p, size_t n, int timeout_ms,
+                    std::chrono::steady_clock::time_point deadline)
+{
+    while (n)
+    {
+        if (!wait_fd(fd, out ? POLLOUT : POLLIN, timeout_ms, deadline))
+            return false;
+        ssize_t r = out ? send(fd, p, n, MSG_NOSIGNAL) : recv(fd, p, n, 0);
+        if (r <= 0)
+        {
+            if (r < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            return false;
+        }
+        p += r;
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+// One query over a fresh TCP connection. Returns the reply length, 0 on
+// timeout, -1 on a socket error (err set).
+static ssize_t tcp_exchange(const sockaddr_storage & server,
+                            socklen_t                server_len,
+                            std::span<const uint8_t> query,
+                            std::span<uint8_t>       rx,
+                            int                      timeout_ms,
+                            std::string &            err)
+{
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(timeout_ms);
+    int fd = open_socket(server.ss_family, SOCK_STREAM);
+    if (fd < 0)
+    {
+        err = std::format("tcp socket: {}", std::strerror(errno));
+        return -1;
+    }
+    ssize_t result = -1;
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&server), server_len) !=
+        0 && errno != EINPROGRESS)
+    {
+        err = std::format("tcp connect: {}", std::strerror(errno));
+    }
+    else if (!wait_fd(fd, POLLOUT, timeout_ms, deadline))
+    {
+        result = 0;
+    }
+    else
+    {
+        int       so_err = 0;
+        socklen_t sl     = sizeof(so_err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_err, &sl);
+        std::array<uint8_t, 2> len{static_cast<uint8_t>(query.size() >> 8),
+                                   static_cast<uint8_t>(query.size())};
+        if (so_err)
+            err = std::format("tcp connect: {}", std::strerror(so_err));
+        else if (!io_full(fd, true, len.data(), 2, timeout_ms, deadline) ||
+                 !io_full(fd, true, const_cast<uint8_t *>(query.data()),
+                          query.size(), timeout_ms, deadline) ||
+                 !io_full(fd, false, len.data(), 2, timeout_ms, deadline))
+            result = 0;
+        else
+        {
+            size_t n = static_cast<size_t>(len[0]) << 8 | len[1];
+            if (n > rx.size() || n < 12)
+                err = "tcp: bad reply length";
+            else if (io_full(fd, false, rx.data(), n, timeout_ms, deadline))
+                result = static_cast<ssize_t>(n);
+            else
+                result = 0;
+        }
+        if (result == 0 && timeout_ms && ms_left(deadline) > 0)
+        {
+            err    = "tcp: connection closed";
+            result = -1;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// --- Precompiled query templates (raw mode) ---
+// The wire query for each (qname, qtype, flags, EDNS) target is encoded once
+// before the run. An attempt copies it into its worker's scratch buffer and
+// patches the ID (and, with --0x20, the case of the qname letters); only the
+// cookie and padding options, whose contents change, are appended per attempt.
+struct QueryTemplate
+{
+    std::string           wire;         // header, question, OPT record
+    size_t                rdlen_at = 0; // offset of the OPT RDLENGTH
+    size_t                qname_len = 0; // wire qname starts at offset 12
+    std::vector<uint16_t> letters;      // qname offsets eligible for 0x20
+};
+
+static void put_u16(std::string &out, uint16_t v)
+{
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v & 0xff);
+}
+
+static void set_u16(std::string &out, size_t at, uint16_t v)
+{
+    out[at]     = static_cast<char>(v >> 8);
+    out[at + 1] = static_cast<char>(v & 0xff);
+}
+
+// Presentation name to wire labels; false for empty or oversized labels or
+// names. Escapes are not interpreted.
+static bool encode_qname(std::string_view name, std::string &out)
+{
+    const size_t start = out.size();
+    if (name.empty()) return false;
+    if (name.ends_with('.')) name.remove_suffix(1);
+    while (!name.empty())
+    {
+        auto dot   = name.find('.');
+        auto label = name.substr(0, dot);
+        if (label.empty() || label.size() > 63) return false;
+        out += static_cast<char>(label.size());
+        out += label;
+        if (dot == std::string_view::npos) break;
+        name.remove_prefix(dot + 1);
+        if (name.empty()) return false; // "a..": empty trailing label
+    }
+    out += '\0';
+    return out.size() - start <= 255;
+}
+
+// Mnemonic or RFC 3597 "TYPEnnn" to a type code; anything unknown falls
+// back to A as it always has
+static uint16_t qtype_code(const std::string &name)
+{
+    for (const auto &[type_name, type_code]: kRrTypes)
+        if (name == type_name) return type_code;
+    uint16_t code = 0;
+    if (name.starts_with("TYPE"))
+    {
+        auto [e, ec] = std::from_chars(name.data() + 4,
+                                       name.data() + name.size(),
+                                       code);
+        if (ec == std::errc{} && e == name.data() + name.size() && code)
+            return code;
+    }
+    return 1;
+}
+
+static bool build_query_template(const std::string &host,
+                                 uint16_t           qtype,
+                                 const Options &    opt,
+                                 const EcsSubnet *  ecs,
+                                 QueryTemplate &    out)
+{
+    std::string &w = out.wire;
+    w.assign(12, '\0');
+    set_u16(w, 2, opt.rd ? 0x0100 : 0); // RD
+    set_u16(w, 4, 1);                   // QDCOUNT
+    set_u16(w, 10, 1);                  // ARCOUNT: the OPT record
+    if (!encode_qname(host, w))
+    {
+        w.clear();
+        return false;
+    }
+    out.qname_len = w.size() - 12;
+    for (size_t i = 12; i < w.size(); ++i)
+        if (std::isalpha(static_cast<unsigned char>(w[i])))
+            out.letters.push_back(static_cast<uint16_t>(i));
+    put_u16(w, qtype);
+    put_u16(w, 1); // IN
+    // OPT: root owner, payload size in CLASS, DO in the TTL flags
+    w += '\0';
+    put_u16(w, 41);
+    put_u16(w, static_cast<uint16_t>(opt.edns_size));
+    put_u16(w, 0);
+    put_u16(w, opt.do_bit ? 0x8000 : 0);
+    out.rdlen_at = w.size();
+    put_u16(w, 0);
+    if (ecs)
+    {
+        put_u16(w, kEdnsClientSubnet);
+        put_u16(w, static_cast<uint16_t>(ecs->wire.size()));
+        w += ecs->wire;
+    }
+    if (opt.nsid)
+    {
+        put_u16(w, kEdnsNsid);
+        put_u16(w, 0);
+    }
+    set_u16(w, out.rdlen_at, static_cast<uint16_t>(w.size() - out.rdlen_at - 2));
+    return true;
+}
+
+// splitmix64; each worker owns one state, so no synchronisation
+static uint64_t next_random(uint64_t &state)
+{
+    uint64_t z = state += 0x9e3779b97f4a7c15ULL;
+    z          = (z ^ z >> 30) * 0xbf58476d1ce4e5b9ULL;
+    z          = (z ^ z >> 27) * 0x94d049bb133111ebULL;
+    return z ^ z >> 31;
+}
+
+// Per-worker ID/0x20 generator, the receive buffer replies are parsed in
+// place from, and the wire of the query being sent over TCP
+struct alignas(64) QueryScratch
+{
+    uint64_t             rng = 0;
+    std::vector<uint8_t> rx;   // kMaxMessage bytes, reused every attempt
+    std::string          wire;
+    double               slow_ms = 0; // --capture-slow pN threshold
+    uint64_t             slow_at = 0; // ...taken after this many attempts
+};
+
+// Fill wire from t with the given ID, flip qname case for --0x20, then
+// append the per-attempt cookie and padding options
+static void patch_query(const QueryTemplate &t,
+                        const Options &      opt,
+                        const std::string &  cookie,
+                        uint16_t             id,
+                        uint64_t &           rng,
+                        std::string &        wire)
+{
+    wire.assign(t.wire); // reuses the slot's capacity
+    set_u16(wire, 0, id);
+    if (opt.case_0x20)
+    {
+        uint64_t r = next_random(rng);
+        for (size_t i = 0; i < t.letters.size(); ++i)
+        {
+            if (i % 64 == 63) r = next_random(rng);
+            if (r >> i % 64 & 1) wire[t.letters[i]] ^= 0x20;
+        }
+    }
+    if (!cookie.empty())
+    {
+        put_u16(wire, kEdnsCookie);
+        put_u16(wire, static_cast<uint16_t>(cookie.size()));
+        wire += cookie;
+    }
+    if (opt.padding)
+    {
+        size_t pad = padding_len(wire.size() + 4, opt.padding);
+        put_u16(wire, kEdnsPadding);
+        put_u16(wire, static_cast<uint16_t>(pad));
+        wire.append(pad, '\0');
+    }
+    set_u16(wire,
+            t.rdlen_at,
+            static_cast<uint16_t>(wire.size() - t.rdlen_at - 2));
+}
+
+// --- Query IDs and the UDP socket pool (raw mode) ---
+// Each event-loop worker keeps many queries in flight over a pool of
+// connected UDP sockets. A DNS ID belongs to exactly one in-flight query on
+// its socket, so a reply is matched by (socket, ID) and then by its
+// question. IDs come from a per-socket free list in random order. When every
+// socket's ID space is in use, the pool opens another socket, which gets a
+// new source port. An answered ID goes back to the tail of the free list, so
+// the socket uses every other free ID before it again and a duplicated reply
+// to the old query finds no owner. An ID whose query timed out is
+// quarantined first, so a late reply to the old query is dropped as stray.
+static constexpr uint32_t kIdSpace = 65536;
+static constexpr uint32_t kNoSlot  = UINT32_MAX;
+
+// Growable FIFO over a ring buffer. Unlike std::deque it allocates nothing
+// until the first push, so an idle source socket costs a few words.
+template <typename T>
+struct Fifo
+{
+    std::vector<T> buf;
+    size_t         head = 0, count = 0;
+
+    bool empty() const { return count == 0; }
+    T &  front() { return buf[head]; }
+
+    void pop_front()
+    {
+        head = (head + 1) % buf.size();
+        --count;
+    }
+
+    void push_back(T v)
+    {
+        if (count == buf.size())
+        {
+            std::vector<T> grown(std::max<size_t>(16, buf.size() * 2));
+            for (size_t k = 0; k < count; ++k)
+                grown[k] = buf[(head + k) % buf.size()];
+            buf  = std::move(grown);
+            head = 0;
+        }
+        buf[(head + count++) % buf.size()] = v;
+    }
+};
+
+// Free IDs of one socket, in FIFO order. IDs never used yet come first, in
+// the order of a keyed permutation of 0..65535 (a 4-round Feistel network
+// over the two bytes), so nothing is shuffled or allocated up front; an ID
+// handed back queues behind them. The n-th fresh ID has rank n, which
+// indexes the socket's owner table, so that table grows only as IDs are
+// first used. Only the owning worker pushes and pops, so no lock is needed.
+struct IdFreeList
+{
+    std::array<uint64_t, 4> keys{};
+    uint32_t                minted = 0; // fresh IDs handed out so far
+    Fifo<uint16_t>          freed;
+
+    explicit IdFreeList(uint64_t seed)
+    {
+        for (auto &k: keys) k = next_random(seed);
+    }
+
+    static uint32_t round(uint32_t half, uint64_t key)
+    {
+        return static_cast<uint32_t>((half + key) * 0x9e3779b97f4a7c15ULL >> 56);
+    }
+
+    // The fresh ID of rank r, and the rank of an ID
+    uint16_t id_of(uint32_t r) const
+    {
+        uint32_t hi = r >> 8 & 0xff, lo = r & 0xff;
+        for (uint64_t k: keys)
+        {
+            const uint32_t t = hi ^ round(lo, k);
+            hi               = lo;
+            lo               = t;
+        }
+        return static_cast<uint16_t>(hi << 8 | lo);
+    }
+
+    uint32_t rank(uint16_t id) const
+    {
+        uint32_t hi = id >> 8, lo = id & 0xffu;
+        for (auto k = keys.rbegin(); k != keys.rend(); ++k)
+        {
+            const uint32_t t = lo ^ round(hi, *k);
+            lo               = hi;
+            hi               = t;
+        }
+        return hi << 8 | lo;
+    }
+
+    bool pop(uint16_t &id)
+    {
+        if (minted < kIdSpace) id = id_of(minted++);
+        else if (freed.empty()) return false;
+        else
+        {
+            id = freed.front();
+            freed.pop_front();
+        }
+        return true;
+    }
+
+    void push(uint16_t id) { freed.push_back(id); }
+};
+
+struct PooledSocket
+{
+    int                   fd  = -1;
+    uint32_t              src = 0; // index into the run's sources, if any
+    IdFreeList            ids;
+    std::vector<uint32_t> owners; // in-flight slot by ID rank, or kNoSlot
+    // --cookie: this socket's client cookie, followed by the server cookie
+    // once one came back; server cookies are bound to the client address
+    std::string cookie;
+    // Timed-out IDs and when they may be reused, oldest first
+    Fifo<std::pair<std::chrono::steady_clock::time_point, uint16_t>> quarantine;
+
+    explicit PooledSocket(uint64_t seed) : ids(seed) {}
+    PooledSocket(const PooledSocket &)            = delete;
+    PooledSocket &operator=(const PooledSocket &) = delete;
+    ~PooledSocket() { if (fd >= 0) close(fd); }
+
+    // The slot waiting for a reply with this ID, or kNoSlot
+    uint32_t owner(uint16_t id) const
+    {
+        const uint32_t r = ids.rank(id);
+        return r < owners.size() ? owners[r] : kNoSlot;
+    }
+
+    void set_owner(uint16_t id, uint32_t slot)
+    {
+        const uint32_t r = ids.rank(id);
+        if (r >= owners.size()) owners.resize(r + 1, kNoSlot);
+        owners[r] = slot;
+    }
+};
+
+// One worker's sockets to the server; only that worker touches it
+struct UdpSocketPool
+{
+    const sockaddr_storage &                   server;
+    socklen_t                                  server_len;
+    std::chrono::milliseconds                  hold; // quarantine time
+    uint64_t &                                 rng;
+    std::vector<std::unique_ptr<PooledSocket>> socks;
+    int                                        busy_poll_us = 0; // SO_BUSY_POLL
+    bool                                       fixed = false; // bound sources only
+    bool                                       cookies = false; // --cookie
+    size_t                                     cur   = 0; // socket tried first
+    uint64_t                                   stray = 0; // dropped replies
+    std::string                                busy_poll_err{}; // setsockopt failure
+
+    // Take a free ID on some socket for in-flight slot, opening a new socket
+    // when all are exhausted. False with err set if no socket can be opened.
+    bool lease(uint32_t                              slot,
+               std::chrono::steady_clock::time_point now,
+               uint32_t &                            sock,
+               uint16_t &                            id,
+               std::string &                         err)
+    {
+        for (size_t k = 0; k < socks.size(); ++k)
+        {
+            size_t        i = (cur + k) % socks.size();
+            PooledSocket &s = *socks[i];
+            while (!s.quarantine.empty() && s.quarantine.front().first <= now)
+            {
+                s.ids.push(s.quarantine.front().second);
+                s.quarantine.pop_front();
+            }
+            if (s.ids.pop(id))
+            {
+                cur        = i;
+                sock       = static_cast<uint32_t>(i);
+                s.set_owner(id, slot);
+                return true;
+            }
+        }
+        if (fixed)
+        {
+            err = "all query IDs of the source sockets are in flight";
+            return false;
+        }
+        int fd = open_socket(server.ss_family, SOCK_DGRAM);
+        if (fd < 0 ||
+            connect(fd, reinterpret_cast<const sockaddr *>(&server), server_len) !=
+            0)
+        {
+            err = std::format("udp socket: {}", std::strerror(errno));
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        adopt(fd, 0);
+        return lease(slot, now, sock, id, err);
+    }
+
+    // Take ownership of a connected socket fd sending from source src
+    void adopt(int fd, uint32_t src)
+    {
+        auto s = std::make_unique<PooledSocket>(next_random(rng));
+        s->fd  = fd;
+        s->src = src;
+        for (size_t i = 0; cookies && i < kClientCookieLen; ++i)
+            s->cookie += static_cast<char>(next_random(rng) & 0xff);
+        // Room for a full window of replies arriving in a burst
+        int rcvbuf = 4 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (busy_poll_us > 0)
+        {
+#ifdef SO_BUSY_POLL
+            if (setsockopt(fd,
+                           SOL_SOCKET,
+                           SO_BUSY_POLL,
+                           &busy_poll_us,
+                           sizeof(busy_poll_us)) != 0)
+                busy_poll_err = std::strerror(errno);
+#else
+            busy_poll_err = "not supported on this platform";
+#endif
+        }
+        socks.push_back(std::move(s));
+        cur = socks.size() - 1;
+    }
+
+    // The query owning (sock, id) was answered or failed outright
+    void release(uint32_t sock, uint16_t id)
+    {
+        socks[sock]->set_owner(id, kNoSlot);
+        socks[sock]->ids.push(id);
+    }
+
+    // The query owning (sock, id) timed out; its reply may still come
+    void retire(uint32_t sock, uint16_t id,
+                std::chrono::steady_clock::time_point now)
+    {
+        socks[sock]->set_owner(id, kNoSlot);
+        socks[sock]->quarantine.push_back({now + hold, id});
+    }
+};
+
+// --- Source addresses and ports (--source-addrs / --source-ports) ---
+// A source is one local address:port raw UDP queries leave from: every
+// listed address (or the wildcard) times every port of the range (or an
+// ephemeral one). Each source is bound once, before the run, and handed to
+// exactly one worker, since two sockets on the same address, port and server
+// would be the same flow.
+struct SourceAddr
+{
+    sockaddr_storage addr{};
+    socklen_t        len = 0;
+    std::string      text; // "192.0.2.1:40000", "[2001:db8::1]", "*:40000"
+};
+
+// IPv4 or IPv6 literal without a port
+static bool parse_source_ip(const std::string &ip,
+                            sockaddr_storage & out,
+                            socklen_t &        len)
+{
+    out = {};
+    if (auto *v4 = reinterpret_cast<sockaddr_in *>(&out);
+        inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1)
+    {
+        v4->sin_family = AF_INET;
+        len            = sizeof(sockaddr_in);
+        return true;
+    }
+    auto *v6 = reinterpret_cast<sockaddr_in6 *>(&out);
+    if (inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) != 1) return false;
+    v6->sin6_family = AF_INET6;
+    len             = sizeof(sockaddr_in6);
+    return true;
+}
+
+// LO-HI or a single port, 1..65535
+static bool parse_port_range(std::string_view val, int &lo, int &hi)
+{
+    auto num = [](std::string_view p, int &out)
+    {
+        auto [e, ec] = std::from_chars(p.data(), p.data() + p.size(), out);
+        return ec == std::errc{} && e == p.data() + p.size() && out >= 1 &&
+               out <= 65535;
+    };
+    auto dash = val.find('-');
+    if (dash == std::string_view::npos) return num(val, lo) && num(val, hi);
+    return num(val.substr(0, dash), lo) && num(val.substr(dash + 1), hi) &&
+           lo <= hi;
+}
+
+static size_t source_count(const Options &opt)
+{
+    size_t ports = opt.source_port_lo
+                       ? static_cast<size_t>(opt.source_port_hi -
+                                             opt.source_port_lo + 1)
+                       : 1;
+    return std::max<size_t>(1, opt.source_addrs.size()) * ports;
+}
+
+// The sources of a run against a server of the given family; empty (with
+// err unset) when no source option was given
+static std::vector<SourceAddr> expand_sources(const Options &opt,
+                                              int            family,
+                                              std::string &  err)
+{
+    std::vector<SourceAddr> out;
+    if (opt.source_addrs.empty() && !opt.source_port_lo) return out;
+    std::vector<std::string> ips = opt.source_addrs;
+    if (ips.empty()) ips.emplace_back(family == AF_INET6 ? "::" : "0.0.0.0");
+    for (const auto &ip: ips)
+    {
+        SourceAddr base;
+        parse_source_ip(ip, base.addr, base.len);
+        if (base.addr.ss_family != family)
+        {
+            err = std::format("source address {} is not in the nameserver's "
+                              "address family",
+                              ip);
+            return {};
+        }
+        const std::string host = opt.source_addrs.empty()
+                                     ? "*"
+                                     : family == AF_INET6
+                                           ? "[" + ip + "]"
+                                           : ip;
+        for (int port = opt.source_port_lo; port <= opt.source_port_hi; ++port)
+        {
+            SourceAddr s = base;
+            if (family == AF_INET6)
+                reinterpret_cast<sockaddr_in6 *>(&s.addr)->sin6_port =
+                        htons(static_cast<uint16_t>(port));
+            else
+                reinterpret_cast<sockaddr_in *>(&s.addr)->sin_port =
+                        htons(static_cast<uint16_t>(port));
+            s.text = port ? std::format("{}:{}", host, port) : host;
+            out.push_back(std::move(s));
+        }
+    }
+    return out;
+}
+
+// A non-blocking UDP socket bound to src and connected to server; -1 with
+// err set on failure
+static int open_source_socket(const SourceAddr &      src,
+                              const sockaddr_storage &server,
+                              socklen_t               server_len,
+                              std::string &           err)
+{
+    int fd = open_socket(server.ss_family, SOCK_DGRAM);
+    if (fd >= 0 &&
+        bind(fd, reinterpret_cast<const sockaddr *>(&src.addr), src.len) == 0 &&
+        connect(fd, reinterpret_cast<const sockaddr *>(&server), server_len) ==
+        0)
+        return fd;
+    err = std::format("cannot use source {}: {}", src.text, std::strerror(errno));
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+// --- Hierarchical timer wheel (raw mode) ---
+// Each event-loop worker owns one wheel holding the timeouts of its in-flight
+// queries. There are four levels of 256 slots. With 100 us ticks, level 0
+// spans 25.6 ms and the whole wheel spans about 5 days. Scheduling and
+// cancelling are O(1) list operations on a node pool. A timer lives on the
+// level of the highest 8-bit tick digit in which its expiry differs from the
+// current tick, and is cascaded one level down each time the current tick
+// enters its slot. A timer whose expiry differs above the top digit (a later
+// deadline, or a near one across a 2^32-tick boundary) waits on an overflow
+// list that is re-linked whenever the top level wraps. Per-level occupancy
+// bitmaps let advance() skip empty stretches and give the next wake-up time.
+struct TimerWheel
+{
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int      kLevels   = 4;
+    static constexpr int      kSlotBits = 8;
+    static constexpr uint32_t kSlots    = 1u << kSlotBits;
+    static constexpr uint32_t kNil      = UINT32_MAX;
+    static constexpr uint32_t kOverflow = kLevels * kSlots; // where, past the top
+    static constexpr uint64_t kTop      = (uint64_t{1} << kSlotBits * kLevels) - 1;
+
+    struct Node
+    {
+        uint64_t expiry  = 0; // tick
+        uint32_t prev    = kNil, next = kNil;
+        uint32_t payload = 0;
+        uint32_t gen     = 0;    // bumped on free, so stale handles miss
+        uint16_t where   = 0;    // level * kSlots + slot, or kOverflow
+        bool     armed   = false;
+    };
+
+    std::chrono::nanoseconds tick;
+    Clock::time_point        origin;
+    uint64_t                 now_tick = 0;
+    std::vector<Node>        nodes;
+    std::vector<uint32_t>    free_nodes;
+    std::array<uint32_t, kLevels * kSlots + 1>  heads{};
+    std::array<std::array<uint64_t, kSlots / 64>, kLevels> occupied{};
+    size_t                   armed = 0;
+
+    explicit TimerWheel(std::chrono::nanoseconds tick_len = std::chrono::microseconds(100),
+                        Clock::time_point        start    = Clock::now())
+        : tick(tick_len), origin(start)
+    {
+        heads.fill(kNil);
+    }
+
+    // Handle of a scheduled timer: generation above the node index
+    uint64_t schedule(Clock::time_point when, uint32_t payload)
+    {
+        uint32_t i;
+        if (!free_nodes.empty())
+        {
+            i = free_nodes.back();
+            free_nodes.pop_back();
+        }
+        else
+        {
+            i = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+        Node &n   = nodes[i];
+        n.payload = payload;
+        n.expiry  = std::max(tick_of(when + tick - std::chrono::nanoseconds(1)),
+                            now_tick + 1); // never before when
+        n.armed   = true;
+        ++armed;
+        link(i);
+        return static_cast<uint64_t>(n.gen) << 32 | i;
+    }
+
+    // No-op when the timer already fired or was cancelled
+    void cancel(uint64_t handle)
+    {
+        auto i = static_cast<uint32_t>(handle);
+        if (i >= nodes.size() || nodes[i].gen != handle >> 32 ||
+            !nodes[i].armed)
+            return;
+        unlink(i);
+        release(i);
+    }
+
+    // Fire, in expiry order, every timer due at or before now
+    template <class Fn>
+    void advance(Clock::time_point now, Fn &&fire)
+    {
+        const uint64_t target = tick_of(now);
+        while (now_tick < target)
+        {
+            // Next tick that has level-0 timers, or the next cascade
+            uint64_t base = now_tick & ~uint64_t{kSlots - 1};
+            uint64_t step = base + next_occupied(0, (now_tick & (kSlots - 1)) + 1);
+            if (step > target)
+            {
+                now_tick = target;
+                break;
+            }
+            now_tick = step;
+            if ((now_tick & (kSlots - 1)) == 0) cascade();
+            uint32_t &head = heads[now_tick & (kSlots - 1)];
+            while (head != kNil)
+            {
+                uint32_t i = head;
+                unlink(i);
+                uint32_t payload = nodes[i].payload;
+                release(i);
+                fire(payload);
+            }
+        }
+    }
+
+    // Earliest time advance() may have work to do; nullopt when empty
+    [[nodiscard]] std::optional<Clock::time_point> next_expiry() const
+    {
+        if (!armed) return std::nullopt;
+        for (int l = 0; l < kLevels; ++l)
+        {
+            const int      shift = l * kSlotBits;
+            const uint32_t digit = (now_tick >> shift) & (kSlots - 1);
+            uint32_t       slot  = next_occupied(l, digit + 1);
+            if (slot == kSlots) continue;
+            // Start of that slot's range: a lower bound for its timers
+            uint64_t span = uint64_t{1} << shift;
+            uint64_t t    = (now_tick >> shift << shift) +
+                         (static_cast<uint64_t>(slot) - digit) * span;
+            return origin + t * tick;
+        }
+        // Only overflow timers: none is due before the top level wraps
+        return origin + ((now_tick | kTop) + 1) * tick;
+    }
+
+    [[nodiscard]] size_t size() const { return armed; }
+
+    [[nodiscard]] uint64_t tick_of(Clock::time_point t) const
+    {
+        if (t <= origin) return 0;
+        return static_cast<uint64_t>((t - origin) / tick);
+    }
+
+    void link(uint32_t i)
+    {
+        Node &n = nodes[i];
+        n.prev  = kNil;
+        uint64_t diff = n.expiry ^ now_tick;
+        if (diff > kTop)
+        {
+            n.where = kOverflow;
+            n.next  = heads[kOverflow];
+            if (n.next != kNil) nodes[n.next].prev = i;
+            heads[kOverflow] = i;
+            return;
+        }
+        int l = 0;
+        while (l + 1 < kLevels && diff >> (kSlotBits * (l + 1))) ++l;
+        uint32_t slot = (n.expiry >> (kSlotBits * l)) & (kSlots - 1);
+        n.where       = static_cast<uint16_t>(l * kSlots + slot);
+        n.next        = heads[n.where];
+        if (n.next != kNil) nodes[n.next].prev = i;
+        heads[n.where] = i;
+        occupied[l][slot / 64] |= uint64_t{1} << slot % 64;
+    }
+
+    void unlink(uint32_t i)
+    {
+        Node &n = nodes[i];
+        if (n.prev != kNil) nodes[n.prev].next = n.next;
+        else heads[n.where] = n.next;
+        if (n.next != kNil) nodes[n.next].prev = n.prev;
+        if (heads[n.where] == kNil && n.where != kOverflow)
+        {
+            uint32_t l = n.where / kSlots, slot = n.where % kSlots;
+            occupied[l][slot / 64] &= ~(uint64_t{1} << slot % 64);
+        }
+    }
+
+    void release(uint32_t i)
+    {
+        nodes[i].armed = false;
+        ++nodes[i].gen;
+        --armed;
+        free_nodes.push_back(i);
+    }
+
+    // First occupied slot >= from on level l, or kSlots
+    [[nodiscard]] uint32_t next_occupied(int l, uint32_t from) const
+    {
+        for (uint32_t w = from / 64; w < kSlots / 64; ++w)
+        {
+            uint64_t bits = occupied[l][w];
+            if (w == from / 64) bits &= ~uint64_t{0} << from % 64;
+            if (bits) return w * 64 + static_cast<uint32_t>(std::countr_zero(bits));
+        }
+        return kSlots;
+    }
+
+    // now_tick just entered a new level-0 revolution: move the timers of
+    // each level whose digit rolled over down towards level 0, top first
+    void cascade()
+    {
+        if (!(now_tick & kTop))
+        {
+            // The top level wrapped: overflow timers now due within the
+            // wheel's span take their places, the rest wait again
+            uint32_t i = heads[kOverflow];
+            heads[kOverflow] = kNil;
+            while (i != kNil)
+            {
+                uint32_t next = nodes[i].next;
+                link(i);
+                i = next;
+            }
+        }
+        for (int l = kLevels - 1; l >= 1; --l)
+        {
+            const int shift = l * kSlotBits;
+            if (now_tick & ((uint64_t{1} << shift) - 1)) continue;
+            uint32_t where = static_cast<uint32_t>(
+                l * kSlots + ((now_tick >> shift) & (kSlots - 1)));
+            uint32_t i = heads[where];
+            heads[where] = kNil;
+            occupied[l][(where % kSlots) / 64] &=
+                    ~(uint64_t{1} << (where % kSlots) % 64);
+            while (i != kNil)
+            {
+                uint32_t next = nodes[i].next;
+                link(i);
+                i = next;
+            }
+        }
+    }
+};
+
+
+// Micro-benchmark of the wheel (wireq bench-timers): insert, cancel, churn
+// and expiry throughput, then how late real timers fire
+static int run_bench_timers(const char *prog, int argc, char **argv)
+{
+    using Clock = std::chrono::steady_clock;
+    size_t count = 1'000'000;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view a = argv[i];
+        std::string_view val;
+        if (a == "--count"sv && i + 1 < argc) val = argv[++i];
+        else if (a.starts_with("--count=")) val = a.substr(8);
+        auto [e, ec] = std::from_chars(val.data(), val.data() + val.size(), count);
+        if (val.empty() || ec != std::errc{} || e != val.data() + val.size() ||
+            count == 0)
+        {
+            std::println("Usage: {} bench-timers [--count N]", prog);
+            return 1;
+        }
+    }
+    auto rate = [](size_t n, Clock::duration d)
+    {
+        double ms = std::chrono::duration<double, std::milli>(d).count();
+        return std::format("{:>9} in {:8.3f} ms ({:.1f} M/s)",
+                           n,
+                           ms,
+                           static_cast<double>(n) / ms / 1e3);
+    };
+    uint64_t              rng = 0x5eed;
+    const auto            t0  = Clock::now();
+    TimerWheel            wheel(std::chrono::microseconds(100), t0);
+    std::vector<uint64_t> handles(count);
+    std::vector<Clock::time_point> when(count);
+    for (auto &w: when)
+        w = t0 + std::chrono::microseconds(1000 + next_random(rng) % 10'000'000);
+
+    std::println("timer wheel: {} levels x {} slots, tick {} us",
+                 TimerWheel::kLevels,
+                 TimerWheel::kSlots,
+                 wheel.tick.count() / 1000);
+    auto a = Clock::now();
+    for (size_t i = 0; i < count; ++i)
+        handles[i] = wheel.schedule(when[i], static_cast<uint32_t>(i));
+    std::println("  insert  {}", rate(count, Clock::now() - a));
+    for (size_t i = count - 1; i > 0; --i)
+        std::swap(handles[i], handles[next_random(rng) % (i + 1)]);
+    a = Clock::now();
+    for (auto h: handles) wheel.cancel(h);
+    std::println("  cancel  {}", rate(count, Clock::now() - a));
+
+    // Cancel-on-response: a steady population of armed timers, each op
+    // cancels the oldest and arms a new one
+    const size_t          armed = std::min<size_t>(count, 65536);
+    std::vector<uint64_t> ring(armed);
+    for (size_t i = 0; i < armed; ++i)
+        ring[i] = wheel.schedule(when[i], static_cast<uint32_t>(i));
+    a = Clock::now();
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t &h = ring[i % armed];
+        wheel.cancel(h);
+        h = wheel.schedule(when[i], static_cast<uint32_t>(i));
+    }
+    std::println("  churn   {}  (insert+cancel pairs, {} armed)",
+                 rate(count, Clock::now() - a),
+                 armed);
+    for (auto h: ring) wheel.cancel(h);
+
+    for (size_t i = 0; i < count; ++i)
+        wheel.schedule(when[i], static_cast<uint32_t>(i));
+    size_t fired = 0;
+    a = Clock::now();
+    wheel.advance(t0 + std::chrono::seconds(11), [&](uint32_t) { ++fired; });
+    std::println("  expire  {}", rate(fired, Clock::now() - a));
+
+    // Precision: timers spread over 200 ms, waited for the way raw_loop does
+    const size_t     n = std::min<size_t>(count, 2000);
+    TimerWheel       live;
+    std::vector<Clock::time_point> due(n);
+    const auto       start = Clock::now();
+    for (size_t i = 0; i < n; ++i)
+    {
+        due[i] = start + std::chrono::microseconds(next_random(rng) % 200'000);
+        live.schedule(due[i], static_cast<uint32_t>(i));
+    }
+    LatencyHistogram    late;
+    size_t              early = 0;
+    std::vector<pollfd> none;
+    while (live.size())
+    {
+        poll_until(none, live.next_expiry());
+        const auto now = Clock::now();
+        live.advance(now, [&](uint32_t i)
+        {
+            if (now < due[i]) ++early;
+            late.record(std::chrono::duration<double, std::milli>(
+                            now - due[i]).count(),
+                        false);
+        });
+    }
+    std::println(
+        "precision: {} timers over 200 ms fired late by p50={:.3f} p99={:.3f} max={:.3f} ms, {} early",
+        n,
+        late.pct_ms(50),
+        late.pct_ms(99),
+        late.max_ms(),
+        early);
+
+    // Wrap: deadlines just across a 2^32-tick boundary, in simulated time
+    TimerWheel wrap(std::chrono::microseconds(100),
+                    start - (uint64_t{1} << 32) * std::chrono::microseconds(100) +
+                        std::chrono::seconds(1));
+    const auto                     wrap_t0 = start;
+    std::vector<Clock::time_point> wrap_due(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        wrap_due[i] = wrap_t0 + std::chrono::microseconds(next_random(rng) % 2'000'000);
+        wrap.schedule(wrap_due[i], static_cast<uint32_t>(i));
+    }
+    size_t wrap_early = 0;
+    for (auto now = wrap_t0; wrap.size() && now < wrap_t0 + std::chrono::seconds(3);
+         now += std::chrono::microseconds(700))
+        wrap.advance(now, [&](uint32_t i) { wrap_early += now < wrap_due[i]; });
+    std::println("wrap: {} timers across a 2^32-tick boundary, {} early, {} left",
+                 n,
+                 wrap_early,
+                 wrap.size());
+    return 0;
+}
+
+// A raw query between send and reply (or timeout)
+struct RawInflight
+{
+    int                                   g    = 0; // try number, 0 if free
+    uint32_t                              sock = 0;
+    uint16_t                              id   = 0;
+    uint64_t                              timer = 0; // TimerWheel handle
+    bool                                  spin  = false; // --busy-poll try
+    bool                                  cookie_sent = false;
+    bool                                  mismatched  = false; // ID matched,
+                                                               // question not
+    std::chrono::steady_clock::time_point t0;
+    std::string                           wire;
+};
+
+// How a raw attempt's exchange ended, handed over for reporting. An empty
+// reply without err is a timeout.
+struct RawOutcome
+{
+    std::chrono::steady_clock::time_point t0;
+    // When the reply came off the socket (after any TCP retry) or the
+    // attempt timed out; unset, the attempt is timed when it is recorded
+    std::chrono::steady_clock::time_point rx_at;
+    const std::string *                   wire        = nullptr; // query sent
+    std::string *                         cookie      = nullptr; // socket's
+    bool                                  cookie_sent = false;
+    bool                                  mismatched  = false;
+    std::span<const uint8_t>              reply; // in the worker's rx buffer
+    std::string                           err;
+    bool                                  truncated = false, fell_back = false;
+    double                                udp_ms    = 0, tcp_ms = 0;
+    size_t                                udp_size  = 0;
+};
+
+// --- NDJSON sampling (--sample) ---
+// Each worker decides on its own whether an attempt writes its line, from
+// its own splitmix64 stream (or the try number, for 1/N), so the choice
+// costs one draw and one compare with nothing shared. 1/N keeps every Nth
+// round over the targets whole, so each host and subnet is sampled alike.
+// Unsampled attempts skip serialisation, but every attempt still feeds the
+// shards, tables and summaries.
+struct alignas(64) LineSampler
+{
+    uint64_t state = 0;
+
+    bool take(int g, int n_targets, const Options &opt)
+    {
+        return opt.sample_every
+                   ? ((g - 1) / n_targets + 1) % opt.sample_every == 0
+                   : next_random(state) <= opt.sample_below;
+    }
+};
+
+// F in (0, 1], or 1/N
+static bool parse_sample(std::string_view val, Options &opt)
+{
+    if (val.starts_with("1/"))
+    {
+        auto rc = std::from_chars(val.data() + 2, val.data() + val.size(),
+                                  opt.sample_every);
+        return rc.ec == std::errc() && rc.ptr == val.data() + val.size() &&
+               opt.sample_every >= 1;
+    }
+    double f  = 0;
+    auto   rc = std::from_chars(val.data(), val.data() + val.size(), f);
+    if (rc.ec != std::errc() || rc.ptr != val.data() + val.size() || !(f > 0) ||
+        f > 1)
+        return false;
+    // f * 2^64 - 1, saturating at f = 1
+    opt.sample_below = f >= 1 ? UINT64_MAX
+                              : std::max<uint64_t>(
+                                    1,
+                                    static_cast<uint64_t>(std::ldexp(f, 64))) - 1;
+    return true;
+}
+
+// --- Tail capture of slow attempts (--capture-slow) ---
+// Everything an attempt's full record needs is still in the worker's own
+// buffers when the attempt completes: the query wire in its slot, the reply
+// in the receive buffer. Only attempts over the threshold, and errors, are
+// serialised from there, with the raw bytes and every section; the rest get
+// a compact record or none, and their RR sections are not even walked.
+
+// The fixed threshold, or the worker's running pN from its own shard,
+// refreshed every 256 attempts. Until the tail beyond pN holds about ten
+// samples, every attempt counts as slow.
+static double capture_threshold(const Options &   opt,
+                                const StatsShard &shard,
+                                QueryScratch &    qs)
+{
+    if (!opt.capture_pctl) return opt.capture_ms;
+    const uint64_t n = StatsShard::get(shard.done);
+    if (n * static_cast<uint64_t>(100 - opt.capture_pctl) < 1000) return 0;
+    if (!qs.slow_at || n - qs.slow_at >= 256)
+    {
+        LatencyHistogram h;
+        shard.snapshot(h);
+        qs.slow_ms = h.pct_ms(opt.capture_pctl);
+        qs.slow_at = n;
+    }
+    return qs.slow_ms;
+}
+
+// ,"capture":{...} for a full record: when the attempt started, the bytes
+// sent and received, and the RRs beyond the answer section
+static void put_capture_json(std::ostringstream &os,
+                             const RawOutcome &  o,
+                             double              start_ms,
+                             const ReplyView *   reply)
+{
+    os << R"(,"capture":{"start_ms":)" << start_ms;
+    if (o.wire) os << R"(,"query":")" << hex_upper(wire_bytes(*o.wire)) << '"';
+    if (!o.reply.empty()) os << R"(,"reply":")" << hex_upper(o.reply) << '"';
+    if (o.mismatched) os << R"(,"mismatched":true)";
+    if (reply && reply->indexed)
+        for (auto sec: {Section::Authority, Section::Additional})
+        {
+            os << (sec == Section::Authority ? R"(,"authority":[)"
+                                             : R"(,"additional":[)");
+            bool first = true;
+            reply->each_rr(sec, [&](const RrView &rr)
+            {
+                os << (first ? "\"" : ",\"")
+                        << json_escape(rr_text(reply->msg, rr)) << "\"";
+                first = false;
+            });
+            os << ']';
+        }
+    os << '}';
+}
+
+// --- Built-in responder (serve) ---
+// wireq serve [--listen ADDR:PORT] [--zone FILE] [--threads N] [--batch N]
+//             [--duration S] [--pin] [--quiet]
+// A loopback UDP responder for benchmarking the client, built so that it is
+// not the bottleneck. Every reply is encoded when the zone is loaded: a
+// header and the answer records, whose owners are compression pointers to
+// the question. Answering a query is one hash lookup on its lower-cased
+// question, then copying the prebuilt header (with the query's ID and RD
+// patched in), the question bytes as received (so 0x20 case survives) and
+// the prebuilt answers, plus a fixed OPT record when the query had one.
+// Each thread owns an SO_REUSEPORT socket on the same address and moves
+// datagrams in batches with recvmmsg/sendmmsg.
+struct ServedAnswer
+{
+    std::array<uint8_t, 12> head{}; // ID and RD patched per query
+    std::string             tail;   // answer records, owners -> offset 12
+};
+
+struct ServeZone
+{
+    // Lower-case wire qname followed by the big-endian qtype
+    std::unordered_map<std::string, ServedAnswer> answers;
+    std::unordered_set<std::string>               owners; // lower-case qnames
+    bool         wildcard = false; // no zone: A/AAAA for every name
+    ServedAnswer any_a, any_aaaa;  // wildcard answers
+    ServedAnswer nxdomain, nodata, notimp;
+};
+
+// OPT record of every EDNS reply: root owner, 1232-byte payload, no options
+static constexpr uint8_t kServeOpt[11] = {0, 0, 41, 0x04, 0xd0, 0, 0, 0, 0, 0, 0};
+
+static ServedAnswer served_answer(int rcode, uint16_t ancount, std::string tail)
+{
+    ServedAnswer a;
+    a.head[2] = 0x84; // QR, AA
+    a.head[3] = static_cast<uint8_t>(rcode);
+    a.head[5] = 1; // QDCOUNT
+    a.head[6] = static_cast<uint8_t>(ancount >> 8);
+    a.head[7] = static_cast<uint8_t>(ancount & 0xff);
+    a.tail    = std::move(tail);
+    return a;
+}
+
+// One answer record owned by the question name
+static void put_served_rr(std::string &      tail,
+                          uint16_t           type,
+                          uint32_t           ttl,
+                          const std::string &rdata)
+{
+    put_u16(tail, 0xc00c);
+    put_u16(tail, type);
+    put_u16(tail, 1); // IN
+    put_u16(tail, static_cast<uint16_t>(ttl >> 16));
+    put_u16(tail, static_cast<uint16_t>(ttl & 0xffff));
+    put_u16(tail, static_cast<uint16_t>(rdata.size()));
+    tail += rdata;
+}
+
+// RDATA of one zone record in wire form; the reason if it cannot be encoded
+static const char *served_rdata(uint16_t         type,
+                                std::string_view text,
+                                std::string &    out)
+{
+    std::istringstream is{std::string(text)};
+    std::string        tok;
+    switch (type)
+    {
+    case 1:
+    case 28:
+    {
+        std::array<unsigned char, 16> addr{};
+        if (!(is >> tok) ||
+            inet_pton(type == 1 ? AF_INET : AF_INET6, tok.c_str(), addr.data()) !=
+            1)
+            return "bad address";
+        out.assign(reinterpret_cast<const char *>(addr.data()),
+                   type == 1 ? 4 : 16);
+        return nullptr;
+    }
+    case 2:
+    case 5:
+    case 12:
+        if (!(is >> tok) || !encode_qname(tok, out)) return "bad name";
+        return nullptr;
+    case 15:
+    {
+        unsigned pref = 0;
+        if (!(is >> pref >> tok) || pref > 0xffff)
+            return "bad MX data";
+        put_u16(out, static_cast<uint16_t>(pref));
+        if (!encode_qname(tok, out)) return "bad name";
+        return nullptr;
+    }
+    case 16:
+    {
+        // One or more character-strings, quoted or bare
+        std::string_view rest = text;
+        while (true)
+        {
+            while (!rest.empty() &&
+                   std::isspace(static_cast<unsigned char>(rest[0])))
+                rest.remove_prefix(1);
+            if (rest.empty()) break;
+            std::string_view s;
+            if (rest[0] == '"')
+            {
+                auto close = rest.find('"', 1);
+                if (close == std::string_view::npos)
+                    return "unterminated string";
+                s = rest.substr(1, close - 1);
+                rest.remove_prefix(close + 1);
+            }
+            else
+            {
+                auto sp = std::ranges::find_if(rest, [](char c)
+                {
+                    return std::isspace(static_cast<unsigned char>(c)) != 0;
+                });
+                s = rest.substr(0, static_cast<size_t>(sp - rest.begin()));
+                rest.remove_prefix(s.size());
+            }
+            if (s.size() > 255) return "string over 255 bytes";
+            out += static_cast<char>(s.size());
+            out += s;
+        }
+        if (out.empty()) return "empty TXT";
+        return nullptr;
+    }
+    default:
+        return "unsupported type (A, AAAA, NS, CNAME, PTR, MX, TXT)";
+    }
+}
+
+static std::string lower_ascii(std::string s)
+{
+    for (char &c: s)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return s;
+}
+
+// "name [ttl] [IN] type rdata" per line, ';' comments; records sharing a
+// name and type form one RRset. Without a file every name answers A
+// 127.0.0.1 and AAAA ::1.
+static bool load_serve_zone(const std::string &path,
+                            ServeZone &        z,
+                            std::string &      err)
+{
+    z.nxdomain = served_answer(3, 0, {});
+    z.nodata   = served_answer(0, 0, {});
+    z.notimp   = served_answer(4, 0, {});
+    if (path.empty())
+    {
+        std::string a, aaaa, tail;
+        served_rdata(1, "127.0.0.1", a);
+        served_rdata(28, "::1", aaaa);
+        put_served_rr(tail, 1, 300, a);
+        z.any_a = served_answer(0, 1, tail);
+        tail.clear();
+        put_served_rr(tail, 28, 300, aaaa);
+        z.any_aaaa = served_answer(0, 1, tail);
+        z.wildcard = true;
+        return true;
+    }
+    std::ifstream in(path);
+    if (!in)
+    {
+        err = "cannot open zone: " + path;
+        return false;
+    }
+    // key -> record count and encoded records
+    std::map<std::string, std::pair<uint16_t, std::string>> rrsets;
+    std::string line;
+    for (int ln = 1; std::getline(in, line); ++ln)
+    {
+        if (auto semi = line.find(';'); semi != std::string::npos)
+            line.erase(semi);
+        std::istringstream is(line);
+        std::string        name, tok;
+        if (!(is >> name)) continue;
+        uint32_t ttl = 300;
+        is >> tok;
+        if (!tok.empty() &&
+            std::ranges::all_of(tok, [](char c) { return c >= '0' && c <= '9'; }))
+        {
+            ttl = static_cast<uint32_t>(std::stoul(tok));
+            is >> tok;
+        }
+        if (tok == "IN") is >> tok;
+        const uint16_t type = qtype_code(tok);
+        std::string    owner, rdata, rest;
+        std::getline(is, rest);
+        const char *why = nullptr;
+        if (!encode_qname(name, owner)) why = "bad owner name";
+        else if (tok.empty() || (type == 1 && tok != "A"))
+            why = "unsupported type (A, AAAA, NS, CNAME, PTR, MX, TXT)";
+        else why = served_rdata(type, rest, rdata);
+        if (why)
+        {
+            err = std::format("{}:{}: {}", path, ln, why);
+            return false;
+        }
+        owner = lower_ascii(owner);
+        z.owners.insert(owner);
+        std::string key = owner;
+        put_u16(key, type);
+        auto &[count, tail] = rrsets[key];
+        put_served_rr(tail, type, ttl, rdata);
+        ++count;
+    }
+    for (auto &[key, set]: rrsets)
+    {
+        if (set.second.size() > kMaxMessage - 12 - 260)
+        {
+            err = std::format("{}: RRset too large for one message", path);
+            return false;
+        }
+        z.answers.emplace(key,
+                          served_answer(0, set.first, std::move(set.second)));
+    }
+    return true;
+}
+
+// Build the reply to query q in out; 0 if q gets none (short, or a reply)
+static size_t serve_reply(const ServeZone &         z,
+                          std::span<const uint8_t> q,
+                          uint8_t *                 out,
+                          std::string &             key)
+{
+    if (q.size() < 12 || q[2] & 0x80) return 0;
+    size_t end = 12;
+    while (end < q.size() && q[end] && !(q[end] & 0xc0)) end += q[end] + 1u;
+    const bool question_ok = get_u16(q, 4) == 1 && end + 5 <= q.size() &&
+                             end - 12 < 255 && !q[end];
+    if (!question_ok)
+    {
+        // FORMERR, header only
+        std::memset(out, 0, 12);
+        out[0] = q[0];
+        out[1] = q[1];
+        out[2] = static_cast<uint8_t>(0x80 | (q[2] & 0x79));
+        out[3] = 1;
+        return 12;
+    }
+    end += 5;
+    const size_t qlen = end - 12;
+    const bool   edns = get_u16(q, 10) >= 1 && end + 11 <= q.size() &&
+                      q[end] == 0 && get_u16(q, end + 1) == 41;
+    const size_t limit = edns ? std::max<size_t>(512, get_u16(q, end + 3)) : 512;
+
+    const ServedAnswer *a = &z.notimp;
+    if ((q[2] >> 3 & 0x0f) == 0)
+    {
+        const uint16_t qtype = get_u16(q, end - 4);
+        if (z.wildcard)
+            a = qtype == 1 ? &z.any_a : qtype == 28 ? &z.any_aaaa : &z.nodata;
+        else
+        {
+            key.assign(reinterpret_cast<const char *>(q.data()) + 12, qlen - 2);
+            for (size_t i = 0; i < qlen - 4; ++i)
+                if (key[i] >= 'A' && key[i] <= 'Z')
+                    key[i] = static_cast<char>(key[i] | 0x20);
+            auto it = z.answers.find(key);
+            if (it == z.answers.end() && qtype != 5)
+            {
+                // A CNAME answers every type of its owner
+                key[qlen - 4] = 0;
+                key[qlen - 3] = 5;
+                it            = z.answers.find(key);
+            }
+            if (it != z.answers.end()) a = &it->second;
+            else
+            {
+                key.resize(qlen - 4);
+                a = z.owners.contains(key) ? &z.nodata : &z.nxdomain;
+            }
+        }
+    }
+    const bool tc = 12 + qlen + a->tail.size() + (edns ? 11 : 0) > limit;
+    std::memcpy(out, a->head.data(), 12);
+    out[0] = q[0];
+    out[1] = q[1];
+    out[2] |= static_cast<uint8_t>(q[2] & 0x01); // RD
+    if (tc)
+    {
+        out[2] |= 0x02;
+        out[6] = out[7] = 0;
+    }
+    out[11] = edns ? 1 : 0;
+    std::memcpy(out + 12, q.data() + 12, qlen);
+    size_t at = end;
+    if (!tc)
+    {
+        std::memcpy(out + at, a->tail.data(), a->tail.size());
+        at += a->tail.size();
+    }
+    if (edns)
+    {
+        std::memcpy(out + at, kServeOpt, sizeof(kServeOpt));
+        at += sizeof(kServeOpt);
+    }
+    return at;
+}
+
+// recvmmsg/sendmmsg come with MSG_WAITFORONE in <sys/socket.h> (Linux,
+// FreeBSD 11+, NetBSD); elsewhere, one datagram per call
+#ifndef MSG_WAITFORONE
+struct mmsghdr
+{
+    msghdr   msg_hdr;
+    unsigned msg_len;
+};
+
+static int recvmmsg(int fd, mmsghdr *v, unsigned n, int, void *)
+{
+    if (!n) return 0;
+    ssize_t r = recvmsg(fd, &v[0].msg_hdr, 0);
+    if (r < 0) return -1;
+    v[0].msg_len = static_cast<unsigned>(r);
+    return 1;
+}
+
+static int sendmmsg(int fd, mmsghdr *v, unsigned n, int)
+{
+    unsigned i = 0;
+    for (; i < n; ++i)
+        if (sendmsg(fd, &v[i].msg_hdr, 0) < 0) break;
+    return i ? static_cast<int>(i) : -1;
+}
+
+#define MSG_WAITFORONE 0
+#endif
+
+struct alignas(64) ServeCounters
+{
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> nxdomain{0};
+    std::atomic<uint64_t> truncated{0};
+    std::atomic<uint64_t> dropped{0}; // not replied to
+};
+
+static std::atomic<bool> g_serve_stop{false};
+
+static void serve_on_signal(int) { g_serve_stop.store(true); }
+
+// One responder thread: receive a batch, build every reply, send the batch
+static void serve_thread(int              fd,
+                         const ServeZone &z,
+                         size_t           batch,
+                         ServeCounters &  c)
+{
+    constexpr size_t         kRx = 4096; // larger queries are dropped
+    std::vector<uint8_t>     rx(batch * kRx), tx(batch * kMaxMessage);
+    std::vector<sockaddr_storage> peers(batch);
+    std::vector<iovec>       rx_iov(batch), tx_iov(batch);
+    std::vector<mmsghdr>     rx_msgs(batch), tx_msgs(batch);
+    std::string              key;
+    key.reserve(260);
+    for (size_t i = 0; i < batch; ++i)
+        rx_iov[i] = {rx.data() + i * kRx, kRx};
+    while (!g_serve_stop.load(std::memory_order_relaxed))
+    {
+        for (size_t i = 0; i < batch; ++i)
+        {
+            rx_msgs[i]                     = {};
+            rx_msgs[i].msg_hdr.msg_name    = &peers[i];
+            rx_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            rx_msgs[i].msg_hdr.msg_iov     = &rx_iov[i];
+            rx_msgs[i].msg_hdr.msg_iovlen  = 1;
+        }
+        int n = recvmmsg(fd, rx_msgs.data(), static_cast<unsigned>(batch),
+                         MSG_WAITFORONE, nullptr);
+        if (n <= 0) continue; // SO_RCVTIMEO expired, or EINTR
+        unsigned out = 0;
+        uint64_t nx = 0, trunc = 0, drop = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            const auto &h   = rx_msgs[i].msg_hdr;
+            size_t      len = 0;
+            if (!(h.msg_flags & MSG_TRUNC))
+                len = serve_reply(z,
+                                  {rx.data() + static_cast<size_t>(i) * kRx,
+                                   rx_msgs[i].msg_len},
+                                  tx.data() + out * kMaxMessage,
+                                  key);
+            if (!len)
+            {
+                ++drop;
+                continue;
+            }
+            const uint8_t *r = tx.data() + out * kMaxMessage;
+            if ((r[3] & 0x0f) == 3) ++nx;
+            if (r[2] & 0x02) ++trunc;
+            tx_iov[out]                    = {const_cast<uint8_t *>(r), len};
+            tx_msgs[out]                   = {};
+            tx_msgs[out].msg_hdr.msg_name    = h.msg_name;
+            tx_msgs[out].msg_hdr.msg_namelen = h.msg_namelen;
+            tx_msgs[out].msg_hdr.msg_iov     = &tx_iov[out];
+            tx_msgs[out].msg_hdr.msg_iovlen  = 1;
+            ++out;
+        }
+        for (unsigned sent = 0; sent < out;)
+        {
+            int k = sendmmsg(fd, tx_msgs.data() + sent, out - sent, 0);
+            if (k < 0)
+            {
+                if (errno == EINTR) continue;
+                drop += out - sent; // e.g. the peer's port is closed
+                break;
+            }
+            sent += static_cast<unsigned>(k);
+        }
+        StatsShard::set(c.queries,
+                        StatsShard::get(c.queries) + static_cast<uint64_t>(n));
+        StatsShard::set(c.nxdomain, StatsShard::get(c.nxdomain) + nx);
+        StatsShard::set(c.truncated, StatsShard::get(c.truncated) + trunc);
+        StatsShard::set(c.dropped, StatsShard::get(c.dropped) + drop);
+    }
+}
+
+static int run_serve(const char *prog, int argc, char **argv)
+{
+    std::string listen = "127.0.0.1:5300", zone_path;
+    int    threads  = static_cast<int>(
+        std::max(1u, std::thread::hardware_concurrency()));
+    int    batch    = 64;
+    double duration = 0;
+    bool   pin = false, quiet = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view a = argv[i];
+        auto value = [&](std::string_view name) -> std::optional<std::string>
+        {
+            if (a == name && i + 1 < argc) return argv[++i];
+            if (a.starts_with(name) && a.size() > name.size() &&
+                a[name.size()] == '=')
+                return std::string(a.substr(name.size() + 1));
+            return std::nullopt;
+        };
+        std::optional<std::string> v;
+        bool ok = true;
+        try
+        {
+            if (a == "--pin"sv) pin = true;
+            else if (a == "--quiet"sv) quiet = true;
+            else if ((v = value("--listen"))) listen = *v;
+            else if ((v = value("--zone"))) zone_path = *v;
+            else if ((v = value("--threads")))
+                ok = (threads = std::stoi(*v)) >= 1 && threads <= 1024;
+            else if ((v = value("--batch")))
+                ok = (batch = std::stoi(*v)) >= 1 && batch <= 1024;
+            else if ((v = value("--duration")))
+                ok = (duration = std::stod(*v)) >= 0;
+            else ok = false;
+        }
+        catch (...) { ok = false; }
+        if (!ok)
+        {
+            std::println(
+                "Usage: {} serve [--listen ADDR:PORT] [--zone FILE] [--threads N]",
+                prog);
+            std::println(
+                "       [--batch N] [--duration S] [--pin] [--quiet]");
+            return 1;
+        }
+    }
+    sockaddr_storage addr{};
+    socklen_t        addr_len = 0;
+    if (!resolve_nameserver(listen, addr, addr_len))
+    {
+        std::println("invalid --listen value: {}", listen);
+        return 1;
+    }
+    ServeZone   zone;
+    std::string err;
+    if (!load_serve_zone(zone_path, zone, err))
+    {
+        std::println("{}", err);
+        return 1;
+    }
+
+    std::vector<int> fds;
+    for (int t = 0; t < threads; ++t)
+    {
+        int fd  = socket(addr.ss_family, SOCK_DGRAM, 0);
+        int one = 1, buf = 8 << 20;
+        timeval tick{0, 100'000}; // wake up to notice a stop
+        if (fd >= 0)
+        {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_REUSEPORT
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tick, sizeof(tick));
+        }
+        if (fd < 0 ||
+            bind(fd, reinterpret_cast<const sockaddr *>(&addr), addr_len) != 0)
+        {
+            std::println("cannot listen on {}: {}", listen, std::strerror(errno));
+            if (fd >= 0) close(fd);
+            for (int f: fds) close(f);
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+    std::signal(SIGINT, serve_on_signal);
+    std::signal(SIGTERM, serve_on_signal);
+    std::println("listening on {} (udp, {} threads, batch {}), {}",
+                 listen,
+                 threads,
+                 batch,
+                 zone.wildcard
+                     ? std::string("wildcard A/AAAA answers")
+                     : std::format("{} RRsets from {}",
+                                   zone.answers.size(),
+                                   zone_path));
+    std::fflush(stdout);
+
+    std::vector<ServeCounters> counters(static_cast<size_t>(threads));
+    std::vector<std::thread>   pool;
+    for (int t = 0; t < threads; ++t)
+        pool.emplace_back([&, t]
+        {
+            if (pin && !pin_to_cpu(t))
+            {
+                std::scoped_lock lk(g_print_mtx);
+                std::println(stderr,
+                             "cannot pin responder thread {} to a CPU",
+                             t);
+            }
+            serve_thread(fds[t], zone, static_cast<size_t>(batch), counters[t]);
+        });
+
+    using Clock = std::chrono::steady_clock;
+    auto total  = [&]
+    {
+        uint64_t q = 0;
+        for (const auto &c: counters) q += StatsShard::get(c.queries);
+        return q;
+    };
+    const auto t0   = Clock::now();
+    auto       prev = t0;
+    uint64_t   prev_q = 0;
+    while (!g_serve_stop.load())
+    {
+        auto next = prev + std::chrono::seconds(1);
+        if (duration > 0)
+            next = std::min(next,
+                            t0 + std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double>(duration)));
+        while (!g_serve_stop.load() && Clock::now() < next)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto     now = Clock::now();
+        uint64_t q   = total();
+        double   dt  = std::chrono::duration<double>(now - prev).count();
+        if (!quiet && dt >= 0.5)
+            std::println("{:>8.1f} s {:>12.0f} qps",
+                         std::chrono::duration<double>(now - t0).count(),
+                         static_cast<double>(q - prev_q) / dt);
+        std::fflush(stdout);
+        prev   = now;
+        prev_q = q;
+        if (duration > 0 &&
+            std::chrono::duration<double>(now - t0).count() >= duration)
+            g_serve_stop.store(true);
+    }
+    for (auto &th: pool) th.join();
+    for (int f: fds) close(f);
+
+    uint64_t nx = 0, trunc = 0, drop = 0;
+    for (const auto &c: counters)
+    {
+        nx += StatsShard::get(c.nxdomain);
+        trunc += StatsShard::get(c.truncated);
+        drop += StatsShard::get(c.dropped);
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+    std::println("served: {} queries in {:.3f} s ({:.0f} qps), NXDOMAIN {}, "
+                 "truncated {}, dropped {}",
+                 total(),
+                 secs,
+                 secs > 0 ? static_cast<double>(total()) / secs : 0.0,
+                 nx,
+                 trunc,
+                 drop);
+    return 0;
+}
+
+// --- Truncation and TCP fallback accounting (raw mode) ---
+struct TransportRecord
+{
+    uint32_t size      = 0; // final reply size in bytes, 0 if none
+    uint32_t udp_size  = 0; // truncated UDP reply size when it fell back
+    bool     truncated = false;
+    bool     fell_back = false;
+    double   udp_ms    = 0; // legs of a fallback attempt
+    double   tcp_ms    = 0;
+};
+
+static constexpr uint32_t kSizeBucket   = 256; // response-size histogram
+static constexpr size_t   kSizeBuckets  = 17;  // 0..4096 plus overflow
+static constexpr std::array<uint32_t, 4> kBufferSizes{512, 1232, 1400, 4096};
+
+struct TransportSummary
+{
+    uint64_t                             responses = 0, truncated = 0;
+    uint64_t                             fallbacks = 0;
+    LatencyHistogram                     udp_leg, tcp_leg;
+    std::array<uint64_t, kSizeBuckets>   buckets{};
+    std::array<uint64_t, kBufferSizes.size()> exceeds{};
+    std::vector<uint32_t>                sizes; // sorted
+    uint64_t                             udp_sockets = 0; // opened by the pools
+    uint64_t                             udp_workers = 0; // event loops
+    uint64_t                             stray = 0; // late/mismatched replies
+};
+
+static TransportSummary summarize_transport(
+    const std::vector<TransportRecord> &recs)
+{
+    TransportSummary t;
+    for (const auto &r: recs)
+    {
+        if (r.size == 0) continue;
+        ++t.responses;
+        t.sizes.push_back(r.size);
+        ++t.buckets[std::min<size_t>(r.size / kSizeBucket, kSizeBuckets - 1)];
+        for (size_t k = 0; k < kBufferSizes.size(); ++k)
+            if (r.size > kBufferSizes[k]) ++t.exceeds[k];
+        if (r.truncated) ++t.truncated;
+        if (r.fell_back)
+        {
+            ++t.fallbacks;
+            t.udp_leg.record(r.udp_ms, false);
+            t.tcp_leg.record(r.tcp_ms, false);
+        }
+    }
+    std::ranges::sort(t.sizes);
+    return t;
+}
+
+static uint32_t size_pct(const TransportSummary &t, int p)
+{
+    if (t.sizes.empty()) return 0;
+    size_t n    = t.sizes.size();
+    size_t rank = std::clamp<size_t>((static_cast<size_t>(p) * n + 99) / 100,
+                                     1,
+                                     n);
+    return t.sizes[rank - 1];
+}
+
+static void print_transport_summary(const TransportSummary &t)
+{
+    auto pct = [&](uint64_t v)
+    {
+        return 100.0 * static_cast<double>(v) / static_cast<double>(t.
+                   responses);
+    };
+    std::println(
+        "transport: {} responses, {} truncated, {} TCP fallbacks ({:.1f}%)",
+        t.responses,
+        t.truncated,
+        t.fallbacks,
+        pct(t.fallbacks));
+    if (t.udp_sockets)
+        std::println(
+            "  udp sockets: {} over {} workers, stray replies dropped: {}",
+            t.udp_sockets,
+            t.udp_workers,
+            t.stray);
+    if (t.fallbacks)
+        std::println(
+            "  fallback legs: udp avg={:.3f} p99={:.3f} ms, tcp avg={:.3f} p99={:.3f} ms",
+            t.udp_leg.avg_ms(),
+            t.udp_leg.pct_ms(99),
+            t.tcp_leg.avg_ms(),
+            t.tcp_leg.pct_ms(99));
+    std::println("response sizes: p50={} p90={} p99={} max={} bytes",
+                 size_pct(t, 50),
+                 size_pct(t, 90),
+                 size_pct(t, 99),
+                 t.sizes.back());
+    std::ostringstream os;
+    os << "  exceeds";
+    for (size_t k = 0; k < kBufferSizes.size(); ++k)
+        os << ' ' << kBufferSizes[k] << ": " << std::fixed <<
+                std::setprecision(1) << pct(t.exceeds[k]) << '%';
+    std::println("{}", os.str());
+    uint64_t peak = *std::ranges::max_element(t.buckets);
+    for (size_t b = 0; b < kSizeBuckets; ++b)
+    {
+        if (!t.buckets[b]) continue;
+        std::string range = b + 1 < kSizeBuckets
+                                ? std::format("{}-{}",
+                                              b * kSizeBucket,
+                                              (b + 1) * kSizeBucket - 1)
+                                : std::format(">={}", b * kSizeBucket);
+        std::println("  {:<10} {:>8}  {}",
+                     range,
+                     t.buckets[b],
+                     std::string(std::max<uint64_t>(1, t.buckets[b] * 40 / peak),
+                                 '#'));
+    }
+}
+
+static void print_transport_json(const TransportSummary &t,
+                                 std::ostringstream &    os)
+{
+    static const std::vector<int> kPctl{50, 90, 99};
+    os << R"("transport":{"responses":)" << t.responses << ",\"truncated\":" <<
+            t.truncated << ",\"fallbacks\":" << t.fallbacks <<
+            ",\"fallback_rate\":" << (t.responses
+                                           ? static_cast<double>(t.fallbacks) /
+                                             static_cast<double>(t.responses)
+                                           : 0.0) << ",\"udp_sockets\":" <<
+            t.udp_sockets << ",\"udp_workers\":" << t.udp_workers <<
+            ",\"stray_replies\":" << t.stray <<
+            ",\"udp_leg\":{";
+    print_hist_json(t.udp_leg, kPctl, os);
+    os << "},\"tcp_leg\":{";
+    print_hist_json(t.tcp_leg, kPctl, os);
+    os << R"(},"sizes":{"p50":)" << size_pct(t, 50) << ",\"p90\":" <<
+            size_pct(t, 90) << ",\"p99\":" << size_pct(t, 99) << ",\"max\":" <<
+            (t.sizes.empty() ? 0 : t.sizes.back()) << ",\"exceeds\":{";
+    for (size_t k = 0; k < kBufferSizes.size(); ++k)
+        os << (k ? "," : "") << "\"" << kBufferSizes[k] << "\":" << t.exceeds[k];
+    os << "},\"histogram\":[";
+    bool first = true;
+    for (size_t b = 0; b < kSizeBuckets; ++b)
+    {
+        if (!t.buckets[b]) continue;
+        if (!first) os << ",";
+        first = false;
+        os << "{\"lo\":" << b * kSizeBucket << ",\"count\":" << t.buckets[b] <<
+                "}";
+    }
+    os << "]}}";
+}
+
+// --- Warmup and steady-state detection (--warmup / --until-stable) ---
+// Attempts in the warmup window (the first N, or those started in the first
+// DURATION) still run and print, but are left out of every summary and
+// reported on their own line. --until-stable watches the merged shards and
+// stops claiming tries once the 95% confidence interval of the chosen
+// percentile is narrow enough; --tries remains the upper bound.
+enum class Phase : unsigned char
+{
+    NotRun,   // never started (the run stopped early)
+    Measured,
+    Warmup,
+};
+
+// Distribution-free 95% CI of a percentile: the order statistics around
+// its rank that bracket it with binomial probability 0.95. ok is false
+// while there are too few samples for the upper bound to exist.
+struct QuantileCi
+{
+    double lo = 0, hi = 0, value = 0;
+    bool   ok = false;
+
+    [[nodiscard]] double width_pct() const
+    {
+        return value > 0 ? 100.0 * (hi - lo) / value : 0.0;
+    }
+};
+
+static QuantileCi quantile_ci(const LatencyHistogram &h, int p)
+{
+    QuantileCi ci;
+    const double n = static_cast<double>(h.total);
+    const double q = std::clamp(p, 1, 99) / 100.0;
+    if (h.total == 0) return ci;
+    const double sd = std::sqrt(n * q * (1 - q));
+    const double lo = std::floor(n * q - 1.96 * sd);
+    const double hi = std::ceil(n * q + 1.96 * sd) + 1;
+    ci.value        = h.pct_ms(p);
+    // At least ~10 samples beyond the percentile before trusting the tail
+    ci.ok = hi <= n && n * (1 - q) >= 10;
+    if (!ci.ok) return ci;
+    ci.lo = h.rank_ms(static_cast<uint64_t>(std::max(1.0, lo)));
+    ci.hi = h.rank_ms(static_cast<uint64_t>(hi));
+    return ci;
+}
+
+// A duration with an ms or s suffix, in milliseconds
+static bool parse_duration_ms(std::string_view val, double &ms)
+{
+    double      v = 0;
+    std::string num(val);
+    size_t      used = 0;
+    try { v = std::stod(num, &used); }
+    catch (...) { return false; }
+    std::string_view unit = val.substr(used);
+    if (!(v >= 0)) return false;
+    if (unit == "ms") ms = v;
+    else if (unit == "s") ms = v * 1000;
+    else return false;
+    return true;
+}
+
+// --warmup value: a count, or a duration with an ms/s suffix
+static bool parse_warmup(std::string_view val, Options &opt)
+{
+    if (!val.empty() && std::isalpha(static_cast<unsigned char>(val.back())))
+        return parse_duration_ms(val, opt.warmup_ms);
+    int  v  = 0;
+    auto rc = std::from_chars(val.data(), val.data() + val.size(), v);
+    if (rc.ec != std::errc() || rc.ptr != val.data() + val.size() || v < 0)
+        return false;
+    opt.warmup_n = v;
+    return true;
+}
+
+static void print_warmup_summary(const LatencyHistogram &h)
+{
+    std::println(
+        "warmup: {} attempts excluded (min={:.3f} ms, avg={:.3f} ms, max={:.3f} ms, errors {})",
+        h.total,
+        h.min_ms(),
+        h.avg_ms(),
+        h.max_ms(),
+        h.errors);
+}
+
+static void print_stability_summary(const QuantileCi &ci,
+                                    const Options &   opt,
+                                    bool              stopped,
+                                    uint64_t          measured)
+{
+    if (!ci.ok)
+    {
+        std::println("stability: p{} not stable after {} attempts (too few samples)",
+                     opt.stable_pctl,
+                     measured);
+        return;
+    }
+    std::println(
+        "stability: p{}={:.3f} ms, 95% CI [{:.3f}, {:.3f}] ({:.1f}% wide, target {:.1f}%) "
+        "after {} attempts{}",
+        opt.stable_pctl,
+        ci.value,
+        ci.lo,
+        ci.hi,
+        ci.width_pct(),
+        opt.stable_width,
+        measured,
+        stopped ? ", stopped early" : ", not stable");
+}
+
+// --- Busy-poll comparison (--busy-poll) ---
+// Tries alternate between receiving by spinning and sleeping in poll, so
+// both modes see the same server, network and moment. The shift between the
+// two answered-latency distributions is the part of the blocking RTT spent
+// waking the client up.
+//
+// One spinning try makes its whole worker loop spin, so the modes alternate
+// in blocks of whole rounds over the targets, at least --concurrency tries
+// long, and a worker drains before it switches: every target is measured
+// both ways, and no try is received in the other mode's way.
+static bool busy_poll_spins(int g, int n_targets, int concurrency)
+{
+    const int rounds = std::max(1, (concurrency + n_targets - 1) / n_targets);
+    return (g - 1) / n_targets / rounds % 2 == 0;
+}
+
+struct BusyPollSplit
+{
+    LatencyHistogram spin, block; // answered tries only
+};
+
+static BusyPollSplit split_busy_poll(const std::vector<double> &       times,
+                                     const std::vector<unsigned char> &failed,
+                                     const std::vector<Phase> &        phase,
+                                     int                               n_targets,
+                                     int                               concurrency)
+{
+    BusyPollSplit s;
+    for (size_t i = 0; i < times.size(); ++i)
+        if (!failed[i] && phase[i] == Phase::Measured)
+            (busy_poll_spins(static_cast<int>(i) + 1, n_targets, concurrency)
+                 ? s.spin
+                 : s.block).record(times[i], false);
+    return s;
+}
+
+static void print_busy_poll_summary(const BusyPollSplit &  s,
+                                    const std::vector<int> &pctl)
+{
+    std::println("busy-poll vs blocking (alternating blocks, answered only):");
+    std::string head = std::format("  {:<10} {:>7}", "mode", "count");
+    for (int p: pctl) head += std::format(" {:>9}", std::format("p{}", p));
+    std::println("{} ms", head);
+    for (const auto *h: {&s.spin, &s.block})
+    {
+        std::string row = std::format("  {:<10} {:>7}",
+                                      h == &s.spin ? "busy-poll" : "blocking",
+                                      h->total);
+        for (int p: pctl) row += std::format(" {:>9.3f}", h->pct_ms(p));
+        std::println("{}", row);
+    }
+    if (!s.spin.total || !s.block.total) return;
+    std::string row = std::format("  {:<10} {:>7}", "shift", "");
+    for (int p: pctl)
+        row += std::format(" {:>+9.3f}", s.spin.pct_ms(p) - s.block.pct_ms(p));
+    double p50 = s.block.pct_ms(50);
+    std::println("{}  ({:+.1f}% at p50)",
+                 row,
+                 p50 > 0 ? 100.0 * (s.spin.pct_ms(50) - p50) / p50 : 0.0);
+}
+
+static void print_busy_poll_json(const BusyPollSplit &  s,
+                                 const std::vector<int> &pctl,
+                                 int                     so_busy_poll_us,
+                                 std::ostringstream &    os)
+{
+    os << R"("busy_poll":{"so_busy_poll_us":)" << so_busy_poll_us <<
+            ",\"spin\":{";
+    print_hist_json(s.spin, pctl, os);
+    os << "},\"block\":{";
+    print_hist_json(s.block, pctl, os);
+    os << "},\"shift_ms\":{";
+    for (size_t i = 0; i < pctl.size(); ++i)
+        os << (i ? "," : "") << "\"p" << pctl[i] << "\":" <<
+                s.spin.pct_ms(pctl[i]) - s.block.pct_ms(pctl[i]);
+    os << "}}";
+}
+
+// --- Throughput/latency sweep (--sweep) ---
+// The raw UDP workers and their socket pools stay up for the whole sweep.
+// Each step runs for --sweep-step with its own concurrency (split over the
+// workers' windows) or target rate (starts paced per worker), then drains
+// before the next begins. qps counts the attempts completed within the
+// step's time; the percentiles cover every attempt the step started.
+struct SweepStep
+{
+    int              value  = 0;     // concurrency, or target qps
+    double           secs   = 0;     // time the step ran for
+    uint64_t         done   = 0;     // attempts completed within secs
+    bool             capped = false; // --tries ran out before the time did
+    LatencyHistogram hist;
+
+    [[nodiscard]] double qps() const
+    {
+        return secs > 0 ? static_cast<double>(done) / secs : 0.0;
+    }
+};
+
+// concurrency=1,2,4 or rate=1000,2000
+static bool parse_sweep(std::string_view val, Options &opt)
+{
+    auto eq = val.find('=');
+    if (eq == std::string_view::npos) return false;
+    std::string_view what = val.substr(0, eq);
+    if (what == "rate") opt.sweep_rate = true;
+    else if (what != "concurrency") return false;
+    opt.sweep.clear();
+    for (std::string_view list = val.substr(eq + 1); !list.empty();)
+    {
+        auto             comma = list.find(',');
+        std::string_view item  = list.substr(0, comma);
+        int              v     = 0;
+        auto rc = std::from_chars(item.data(), item.data() + item.size(), v);
+        if (rc.ec != std::errc() || rc.ptr != item.data() + item.size() ||
+            v < 1 || v > (opt.sweep_rate ? 10'000'000 : 65536))
+            return false;
+        opt.sweep.push_back(v);
+        list = comma == std::string_view::npos ? "" : list.substr(comma + 1);
+    }
+    return !opt.sweep.empty();
+}
+
+static void print_sweep_header(const Options &opt, const std::vector<int> &pctl)
+{
+    std::println("sweep: {} steps of {:.1f} s",
+                 opt.sweep.size(),
+                 opt.sweep_step_ms / 1000);
+    std::string head = std::format("  {:>11} {:>11} {:>9} {:>7}",
+                                   opt.sweep_rate ? "rate" : "concurrency",
+                                   "qps",
+                                   "count",
+                                   "errors");
+    for (int p: pctl) head += std::format(" {:>9}", std::format("p{}", p));
+    std::println("{} ms", head);
+}
+
+static void print_sweep_row(const SweepStep &st, const std::vector<int> &pctl)
+{
+    std::string row = std::format("  {:>11} {:>11.1f} {:>9} {:>7}",
+                                  st.value,
+                                  st.qps(),
+                                  st.hist.total,
+                                  st.hist.errors);
+    for (int p: pctl) row += std::format(" {:>9.3f}", st.hist.pct_ms(p));
+    std::println("{}{}", row, st.capped ? "  (--tries ran out)" : "");
+}
+
+static void print_sweep_json(const SweepStep &       st,
+                             const Options &         opt,
+                             const std::vector<int> &pctl,
+                             std::ostringstream &    os)
+{
+    os << '"' << (opt.sweep_rate ? "rate" : "concurrency") << "\":" << st.value
+            << ",\"secs\":" << st.secs << ",\"qps\":" << st.qps() <<
+            ",\"capped\":" << (st.capped ? "true" : "false") << ',';
+    print_hist_json(st.hist, pctl, os);
+}
+
+// --- EDNS Client Subnet probing (--ecs-list / --ecs-range) ---
+static constexpr size_t   kMaxEcsSubnets    = size_t{1} << 20;
+
+// Build the canonical text and wire payload for addr/prefix, clearing the
+// host bits as RFC 7871 requires.
+static EcsSubnet make_ecs(int af, std::array<unsigned char, 16> addr, int prefix)
+{
+    const int bits = af == AF_INET6 ? 128 : 32;
+    for (int b = prefix; b < bits; ++b)
+        addr[b / 8] &= static_cast<unsigned char>(~(0x80u >> (b % 8)));
+    EcsSubnet e;
+    char      buf[INET6_ADDRSTRLEN]{};
+    inet_ntop(af, addr.data(), buf, sizeof(buf));
+    e.text = std::format("{}/{}", buf, prefix);
+    e.wire = {'\0', static_cast<char>(af == AF_INET6 ? 2 : 1),
+              static_cast<char>(prefix), '\0'};
+    e.wire.append(reinterpret_cast<const char *>(addr.data()),
+                  static_cast<size_t>(prefix + 7) / 8);
+    return e;
+}
+
+static bool parse_cidr(std::string_view               s,
+                       int &                          af,
+                       std::array<unsigned char, 16> &addr,
+                       int &                          prefix)
+{
+    auto slash = s.find('/');
+    if (slash == std::string_view::npos) return false;
+    std::string ip(s.substr(0, slash));
+    af = ip.find(':') != std::string::npos ? AF_INET6 : AF_INET;
+    addr.fill(0);
+    if (inet_pton(af, ip.c_str(), addr.data()) != 1) return false;
+    auto pfx = s.substr(slash + 1);
+    auto [p, ec] = std::from_chars(pfx.data(), pfx.data() + pfx.size(), prefix);
+    return ec == std::errc{} && p == pfx.data() + pfx.size() && prefix >= 0 &&
+           prefix <= (af == AF_INET6 ? 128 : 32);
+}
+
+// "10.0.0.0/16:24" enumerates the /24s inside 10.0.0.0/16 in address order
+static bool expand_ecs_range(std::string_view spec, std::vector<EcsSubnet> &out)
+{
+    auto colon = spec.rfind(':');
+    if (colon == std::string_view::npos) return false;
+    int                           af = 0, prefix = 0, step = 0;
+    std::array<unsigned char, 16> addr{};
+    auto                          st = spec.substr(colon + 1);
+    auto [p, ec] = std::from_chars(st.data(), st.data() + st.size(), step);
+    if (ec != std::errc{} || p != st.data() + st.size() ||
+        !parse_cidr(spec.substr(0, colon), af, addr, prefix))
+        return false;
+    if (step < prefix || step > (af == AF_INET6 ? 128 : 32) ||
+        step - prefix > std::countr_zero(kMaxEcsSubnets))
+        return false;
+    const uint64_t count = uint64_t{1} << (step - prefix);
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        // Write i into bits [prefix, step) of the address, MSB first
+        for (int b = 0; b < step - prefix; ++b)
+        {
+            int  bit = step - 1 - b;
+            auto m   = static_cast<unsigned char>(0x80u >> (bit % 8));
+            if (i >> b & 1) addr[bit / 8] |= m;
+            else addr[bit / 8] &= static_cast<unsigned char>(~m);
+        }
+        out.push_back(make_ecs(af, addr, step));
+    }
+    return true;
+}
+
+// --- Cache behaviour inferred from answer TTLs (--cache-stats) ---
+enum class CacheClass : unsigned char { Unknown, Hit, Miss };
+
+// Classify raw attempts per target (host, subnet), in send order. A TTL that keeps counting
+// down from the previous observation is a cache hit, as is any TTL below the
+// largest one seen for the name (some cache held it for a while). A full TTL
+// on the first observation or after a reset may be a fresh upstream fetch or
+// a just-refilled cache; those are settled by latency: slower than twice the
+// median certain-hit latency counts as a miss.
+static std::vector<CacheClass> classify_cache(
+    const std::vector<int64_t> &ttls,   // min answer TTL, -1 if none
+    const std::vector<double> & starts, // send time since run start, ms
+    const std::vector<double> & times,  // latency, ms
+    int                         n_targets) // attempt i hits target i % n_targets
+{
+    const size_t            n = ttls.size();
+    std::vector<CacheClass> out(n, CacheClass::Unknown);
+    std::vector<size_t>     candidates; // full TTL without countdown evidence
+    std::vector<double>     hit_ms;
+    std::vector<int64_t>    max_ttl(n_targets, -1);
+    for (size_t i = 0; i < n; ++i)
+        max_ttl[i % n_targets] = std::max(max_ttl[i % n_targets], ttls[i]);
+
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), size_t{0});
+    std::ranges::stable_sort(order,
+                             [&](size_t a, size_t b)
+                             {
+                                 return starts[a] < starts[b];
+                             });
+    std::vector<std::ptrdiff_t> prev(n_targets, -1);
+    for (size_t i: order)
+    {
+        if (ttls[i] < 0) continue;
+        auto &p          = prev[i % n_targets];
+        bool  counting   = false;
+        if (p >= 0)
+        {
+            double expected = static_cast<double>(ttls[p]) - (starts[i] -
+                                  starts[p]) / 1000.0;
+            counting = static_cast<double>(ttls[i]) <= expected + 1.0;
+        }
+        p = static_cast<std::ptrdiff_t>(i);
+        if (counting || ttls[i] < max_ttl[i % n_targets])
+        {
+            out[i] = CacheClass::Hit;
+            hit_ms.push_back(times[i]);
+        }
+        else
+        {
+            candidates.push_back(i);
+        }
+    }
+    double threshold = 0;
+    if (!hit_ms.empty())
+    {
+        auto mid = hit_ms.begin() + static_cast<std::ptrdiff_t>(hit_ms.size() /
+                       2);
+        std::ranges::nth_element(hit_ms, mid);
+        threshold = 2.0 * *mid;
+    }
+    for (size_t i: candidates)
+        out[i] = hit_ms.empty() || times[i] > threshold
+                     ? CacheClass::Miss
+                     : CacheClass::Hit;
+    return out;
+}
+
+struct CacheSummary
+{
+    LatencyHistogram hit, miss;
+    uint64_t         unknown     = 0;
+    uint64_t         tail        = 0; // attempts at or above the overall p99
+    uint64_t         tail_misses = 0;
+};
+
+static CacheSummary summarize_cache(const std::vector<CacheClass> &cls,
+                                    const std::vector<double> &    times,
+                                    double                         p99)
+{
+    CacheSummary c;
+    for (size_t i = 0; i < cls.size(); ++i)
+    {
+        if (cls[i] == CacheClass::Unknown)
+        {
+            ++c.unknown;
+            continue;
+        }
+        (cls[i] == CacheClass::Hit ? c.hit : c.miss).record(times[i], false);
+        if (times[i] >= p99)
+        {
+            ++c.tail;
+            if (cls[i] == CacheClass::Miss) ++c.tail_misses;
+        }
+    }
+    return c;
+}
+
+static void print_cache_summary(const CacheSummary &c)
+{
+    uint64_t known = c.hit.total + c.miss.total;
+    std::println("cache: hits={} misses={} unknown={} (miss rate {:.1f}%)",
+                 c.hit.total,
+                 c.miss.total,
+                 c.unknown,
+                 known
+                     ? 100.0 * static_cast<double>(c.miss.total) / static_cast<
+                           double>(known)
+                     : 0.0);
+    for (const auto &[name, h]: {
+             std::pair<const char *, const LatencyHistogram *>{"hit", &c.hit},
+             {"miss", &c.miss}
+         })
+    {
+        if (!h->total) continue;
+        std::println(
+            "  {:<5} min={:.3f} avg={:.3f} max={:.3f} p50={:.3f} p90={:.3f} p99={:.3f} ms",
+            std::string(name) + ":",
+            h->min_ms(),
+            h->avg_ms(),
+            h->max_ms(),
+            h->pct_ms(50),
+            h->pct_ms(90),
+            h->pct_ms(99));
+    }
+    if (c.tail)
+        std::println("  p99 tail: {} of {} attempts are misses ({:.1f}%)",
+                     c.tail_misses,
+                     c.tail,
+                     100.0 * static_cast<double>(c.tail_misses) /
+                     static_cast<double>(c.tail));
+}
+
+static void print_cache_summary_json(const CacheSummary &c,
+                                     std::ostringstream &os)
+{
+    static const std::vector<int> kPctl{50, 90, 99};
+    os << R"("cache":{"hits":)" << c.hit.total << ",\"misses\":" << c.miss.
+            total << ",\"unknown\":" << c.unknown << ",\"hit\":{";
+    print_hist_json(c.hit, kPctl, os);
+    os << "},\"miss\":{";
+    print_hist_json(c.miss, kPctl, os);
+    os << "},\"tail_miss_share\":" << (c.tail
+                                           ? static_cast<double>(c.tail_misses)
+                                             / static_cast<double>(c.tail)
+                                           : 0.0) << "}";
+}
+
+// --- Live terminal view (--live) ---
+// Redrawn at a fixed rate from the shards, so its cost depends on the number
+// of workers and the refresh interval, never on the query rate.
+static constexpr auto   kLiveRefresh    = std::chrono::milliseconds(250);
+static constexpr size_t kLiveWindow     = 20; // refreshes in the rolling window
+static constexpr size_t kLiveSparkWidth = 60;
+
+static std::string sparkline(const std::vector<double> &vals)
+{
+    static constexpr std::string_view kBars[] = {
+        "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"
+    };
+    double lo = INFINITY, hi = 0;
+    for (double v: vals)
+    {
+        if (v <= 0) continue;
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+    }
+    std::string out;
+    for (double v: vals)
+    {
+        if (v <= 0)
+        {
+            out += ' ';
+            continue;
+        }
+        size_t k = hi > lo
+                       ? static_cast<size_t>((v - lo) / (hi - lo) * 7.0 + 0.5)
+                       : 0;
+        out += kBars[std::min<size_t>(k, 7)];
+    }
+    return out;
+}
+
+static void run_live_view(const Options &             opt,
+                          int                         total,
+                          std::span<const StatsShard> shards,
+                          std::mutex &                   stop_mtx,
+                          std::condition_variable &      stop_cv,
+                          const bool &                   stop)
+{
+    FILE *out = opt.json || opt.ndjson ? stderr : stdout;
+    auto  t0  = std::chrono::steady_clock::now();
+    // window[k] is the cumulative histogram k refreshes ago
+    std::vector<LatencyHistogram> window;
+    std::vector<double>           spark;
+    uint64_t                      prev_done = 0;
+    auto                          prev_t    = t0;
+    std::print(out, "\x1b[2J");
+    for (bool last = false; !last;)
+    {
+        {
+            std::unique_lock lk(stop_mtx);
+            last = stop_cv.wait_for(lk, kLiveRefresh, [&] { return stop; });
+        }
+        auto             now = std::chrono::steady_clock::now();
+        LatencyHistogram cur;
+        uint64_t         inflight = 0;
+        std::array<uint64_t, StatsShard::kRcodeSlots> results{};
+        for (const auto &s: shards)
+        {
+            s.snapshot(cur);
+            inflight += StatsShard::get(s.inflight);
+            for (size_t i = 0; i < results.size(); ++i)
+                results[i] += StatsShard::get(s.results[i]);
+        }
+
+        // Rolling percentiles: cumulative now minus cumulative window ago
+        auto delta = [&](const LatencyHistogram &older)
+        {
+            LatencyHistogram d;
+            d.min_ns = 0;
+            d.max_ns = UINT64_MAX;
+            for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i)
+            {
+                d.counts[i] = cur.counts[i] - older.counts[i];
+                d.total += d.counts[i];
+            }
+            return d;
+        };
+        LatencyHistogram empty;
+        LatencyHistogram roll = delta(window.empty() ? empty : window.front());
+        LatencyHistogram tick = delta(window.empty() ? empty : window.back());
+        size_t           span = std::max<size_t>(window.size(), 1);
+        spark.push_back(tick.total ? tick.pct_ms(50) : 0.0);
+        if (spark.size() > kLiveSparkWidth) spark.erase(spark.begin());
+        window.push_back(cur);
+        if (window.size() > kLiveWindow) window.erase(window.begin());
+
+        double secs = std::chrono::duration<double>(now - prev_t).count();
+        double qps  = secs > 0
+                          ? static_cast<double>(cur.total - prev_done) / secs
+                          : 0.0;
+        prev_done = cur.total;
+        prev_t    = now;
+
+        std::string results_line;
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            if (!results[i]) continue;
+            std::string label = result_label(i, !opt.qtype.empty());
+            results_line += std::format(
+                "  {} {} ({:.1f}%)",
+                label,
+                results[i],
+                100.0 * static_cast<double>(results[i]) / static_cast<double>(
+                    cur.total));
+        }
+
+        std::string frame = "\x1b[H";
+        frame += std::format("wireq live: {}{}  workers={}  elapsed {:.1f}s\x1b[K\n",
+                             opt.hosts.size() > 1
+                                 ? std::to_string(opt.hosts.size()) + " hosts"
+                                 : opt.host,
+                             opt.qtype.empty() ? "" : "  type=" + opt.qtype,
+                             shards.size(),
+                             std::chrono::duration<double>(now - t0).count());
+        frame += std::format(
+            "done {}/{} ({:.1f}%)  qps {:.1f}  in-flight {}\x1b[K\n",
+            cur.total,
+            total,
+            100.0 * static_cast<double>(cur.total) / total,
+            qps,
+            inflight);
+        frame += std::format(
+            "rolling {:.1f}s: p50={:.3f} ms  p90={:.3f} ms  p99={:.3f} ms  (n={})\x1b[K\n",
+            std::chrono::duration<double>(kLiveRefresh * span).count(),
+            roll.pct_ms(50),
+            roll.pct_ms(90),
+            roll.pct_ms(99),
+            roll.total);
+        frame += std::format(
+            "total:        p50={:.3f} ms  p90={:.3f} ms  p99={:.3f} ms  min={:.3f} max={:.3f}\x1b[K\n",
+            cur.pct_ms(50),
+            cur.pct_ms(90),
+            cur.pct_ms(99),
+            cur.min_ms(),
+            cur.max_ms());
+        frame += std::format("results:{}\x1b[K\n", results_line);
+        frame += std::format("p50 {}\x1b[K\n\x1b[J", sparkline(spark));
+        std::print(out, "{}", frame);
+        std::fflush(out);
+    }
+}
+
+// Parent side of --procs: run the live view over the shared shards if asked,
+// reap the children and print the merged summary. Nonzero if a child failed.
+static int run_procs_parent(const Options &           opt,
+                            const SharedStats &       ss,
+                            const std::vector<pid_t> &kids,
+                            int                       total,
+                            bool                      raw_async)
+{
+    std::mutex              live_mtx;
+    std::condition_variable live_cv;
+    bool                    live_stop = false;
+    std::thread             live_thread;
+    if (opt.live)
+        live_thread = std::thread([&]
+        {
+            run_live_view(opt, total, ss.all(), live_mtx, live_cv, live_stop);
+        });
+    int failed = 0;
+    for (pid_t pid: kids)
+    {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ++failed;
+    }
+    if (live_thread.joinable())
+    {
+        {
+            std::scoped_lock lk(live_mtx);
+            live_stop = true;
+        }
+        live_cv.notify_one();
+        live_thread.join();
+    }
+    if (failed)
+        std::println(stderr, "{} of {} worker processes failed", failed, kids.size());
+
+    if (!opt.hist_out.empty())
+    {
+        LatencyHistogram hist;
+        for (const auto &shard: ss.all()) shard.snapshot(hist);
+        if (!hist_write_file(opt.hist_out, hist, opt.compress_level))
+        {
+            std::println(stderr, "cannot write histogram: {}", opt.hist_out);
+            return 1;
+        }
+    }
+    if (!opt.ndjson) print_procs_summary(opt, ss, raw_async);
+    return failed ? 1 : 0;
+}
+
+static bool parse_args(int argc, char **argv, Options &opt)
+{
+    // --sweep picks its own defaults for these unless they were given
+    bool tries_set = false, concurrency_set = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view a = argv[i];
+        if (a == "-h"sv || a == "--help"sv)
+        {
+            print_usage(argv[0]);
+            return false;
+        }
+        if (a == "-4"sv)
+        {
+            opt.family = Family::IPv4;
+        }
+        else if (a == "-6"sv)
+        {
+            opt.family = Family::IPv6;
+        }
+        else if (a == "--all"sv)
+        {
+            opt.all = true;
+        }
+        else if (a == "--v4mapped"sv)
+        {
+            opt.v4mapped = true;
+        }
+        else if (a == "--numeric-host"sv)
+        {
+            opt.numeric_host = true;
+        }
+        else if (a == "--addrconfig"sv)
+        {
+            opt.addrconfig = true;
+        }
+        else if (a == "--no-addrconfig"sv)
+        {
+            opt.addrconfig = false;
+        }
+        else if (a == "--canonname"sv)
+        {
+            opt.canonname = true;
+        }
+        else if (a == "--no-canonname"sv)
+        {
+            opt.canonname = false;
+        }
+        else if (a.rfind("--family", 0) == 0)
+        {
+            // starts_with
+            std::string val;
+            if (a == "--family"sv && i + 1 < argc)
+            {
+                val = argv[++i];
+            }
+            else if (a.size() > 9 && a.substr(8, 1) == "="sv)
+            {
+                val = std::string(a.substr(9));
+            }
+            else
+            {
+                std::println("invalid --family usage");
+                return false;
+            }
+            if (val == "any") opt.family = Family::Any;
+            else if (val == "inet") opt.family = Family::IPv4;
+            else if (val == "inet6") opt.family = Family::IPv6;
+            else
+            {
+                std::println("unknown family: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--service", 0) == 0)
+        {
+            if (a == "--service"sv && i + 1 < argc)
+            {
+                opt.service = argv[++i];
+            }
+            else if (a.size() > 10 && a.substr(9, 1) == "="sv)
+            {
+                opt.service = std::string(a.substr(10));
+            }
+            else
+            {
+                std::println("invalid --service usage");
+                return false;
+            }
+        }
+        else if (a.rfind("--socktype", 0) == 0)
+        {
+            std::string val;
+            if (a == "--socktype"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 11 && a.substr(10, 1) ==
+                     "="sv)
+                val = std::string(a.substr(11));
+            else
+            {
+                std::println("invalid --socktype usage");
+                return false;
+            }
+            if (val == "stream") opt.socktype = SOCK_STREAM;
+            else if (val == "dgram") opt.socktype = SOCK_DGRAM;
+            else if (val == "raw") opt.socktype = SOCK_RAW;
+            else if (val == "any") opt.socktype = 0;
+            else
+            {
+                std::println("unknown socktype: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--protocol", 0) == 0)
+        {
+            std::string val;
+            if (a == "--protocol"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 11 && a.substr(10, 1) ==
+                     "="sv)
+                val = std::string(a.substr(11));
+            else
+            {
+                std::println("invalid --protocol usage");
+                return false;
+            }
+            if (val == "tcp") opt.protocol = IPPROTO_TCP;
+            else if (val == "udp") opt.protocol = IPPROTO_UDP;
+            else if (val == "any") opt.protocol = 0;
+            else
+            {
+                std::println("unknown protocol: {}", val);
+                return false;
+            }
+        }
+        else if (a == "--reverse"sv || a == "--ptr"sv)
+        {
+            opt.reverse = true;
         }
         else if (a == "--ni-namereqd"sv)
         {
@@ -626,6 +5735,7 @@ static bool parse_args(int argc, char **argv, Options &opt)
                 return false;
             }
             if (opt.concurrency <= 0) opt.concurrency = 1;
+            concurrency_set = true;
         }
         else if (a == "--json"sv)
         {
@@ -639,6 +5749,77 @@ static bool parse_args(int argc, char **argv, Options &opt)
         {
             opt.ndjson = true;
         }
+        else if (a == "--live"sv)
+        {
+            opt.live = true;
+        }
+        else if (a == "--per-host"sv)
+        {
+            opt.per_host = true;
+        }
+        else if (a == "--answer-sets"sv)
+        {
+            opt.answer_sets = true;
+        }
+        else if (a == "--cache-stats"sv)
+        {
+            opt.cache_stats = true;
+        }
+        else if (a.rfind("--hosts-file", 0) == 0)
+        {
+            if (a == "--hosts-file"sv && i + 1 < argc)
+                opt.hosts_file = argv[++i];
+            else if (a.size() > 13 && a.substr(12, 1) == "="sv)
+                opt.hosts_file = std::string(a.substr(13));
+            else
+            {
+                std::println("invalid --hosts-file usage");
+                return false;
+            }
+        }
+        else if (a.rfind("--ecs-list", 0) == 0)
+        {
+            if (a == "--ecs-list"sv && i + 1 < argc)
+                opt.ecs_file = argv[++i];
+            else if (a.size() > 11 && a.substr(10, 1) == "="sv)
+                opt.ecs_file = std::string(a.substr(11));
+            else
+            {
+                std::println("invalid --ecs-list usage");
+                return false;
+            }
+        }
+        else if (a.rfind("--ecs-range", 0) == 0)
+        {
+            if (a == "--ecs-range"sv && i + 1 < argc)
+                opt.ecs_range = argv[++i];
+            else if (a.size() > 12 && a.substr(11, 1) == "="sv)
+                opt.ecs_range = std::string(a.substr(12));
+            else
+            {
+                std::println("invalid --ecs-range usage");
+                return false;
+            }
+        }
+        else if (a.rfind("--top", 0) == 0)
+        {
+            std::string val;
+            if (a == "--top"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 6 && a.substr(5, 1) == "="sv)
+                val = std::string(a.substr(6));
+            else
+            {
+                std::println("invalid --top usage");
+                return false;
+            }
+            try { opt.top_n = std::stoi(val); }
+            catch (...)
+            {
+                std::println("invalid --top value: {}", val);
+                return false;
+            }
+            if (opt.top_n < 0) opt.top_n = 0;
+        }
         else if (a.rfind("--pctl", 0) == 0)
         {
             std::string val;
@@ -655,65 +5836,18 @@ static bool parse_args(int argc, char **argv, Options &opt)
                 std::println("invalid --pctl usage");
                 return false;
             }
-            std::vector<int> out;
-            std::string      num;
-            for (char ch: val)
-            {
-                if (ch == ',')
-                {
-                    if (!num.empty())
-                    {
-                        try
-                        {
-                            int p = std::stoi(num);
-                            if (p < 0 || p > 100)
-                            {
-                                std::println("percentile out of range: {}", p);
-                                return false;
-                            }
-                            out.push_back(p);
-                        }
-                        catch (...)
-                        {
-                            std::println("invalid percentile: {}", num);
-                            return false;
-                        }
-                        num.clear();
-                    }
-                }
-                else if (ch >= '0' && ch <= '9')
-                {
-                    num.push_back(ch);
-                }
-                else
-                {
-                    std::println(
-                        "invalid --pctl character: {}",
-                        std::string(1, ch));
-                    return false;
-                }
-            }
-            if (!num.empty())
+            if (!parse_pctl_list(val, opt.pctl)) return false;
+        }
+        else if (a.rfind("--hist-out", 0) == 0)
+        {
+            if (a == "--hist-out"sv && i + 1 < argc) opt.hist_out = argv[++i];
+            else if (a.size() > 11 && a.substr(10, 1) == "="sv)
+                opt.hist_out = std::string(a.substr(11));
+            else
             {
-                try
-                {
-                    int p = std::stoi(num);
-                    if (p < 0 || p > 100)
-                    {
-                        std::println("percentile out of range: {}", p);
-                        return false;
-                    }
-                    out.push_back(p);
-                }
-                catch (...)
-                {
-                    std::println("invalid percentile: {}", num);
-                    return false;
-                }
+                std::println("invalid --hist-out usage");
+                return false;
             }
-            std::ranges::sort(out);
-            out.erase(std::ranges::unique(out).begin(), out.end());
-            opt.pctl = std::move(out);
         }
         else if (a.rfind("--tries", 0) == 0)
         {
@@ -738,6 +5872,7 @@ static bool parse_args(int argc, char **argv, Options &opt)
                 return false;
             }
             if (opt.tries <= 0) opt.tries = 1;
+            tries_set = true;
         }
         else if (a.rfind("--type", 0) == 0)
         {
@@ -761,6 +5896,10 @@ static bool parse_args(int argc, char **argv, Options &opt)
                 });
             opt.qtype = std::move(val);
         }
+        else if (a == "--nsid"sv) // before the --ns prefix match
+        {
+            opt.nsid = true;
+        }
         else if (a.rfind("--ns", 0) == 0)
         {
             if (a == "--ns"sv && i + 1 < argc) opt.ns = argv[++i];
@@ -791,55 +5930,409 @@ static bool parse_args(int argc, char **argv, Options &opt)
                 opt.rd = false;
             else
             {
-                std::println("invalid --rd value: {}", val);
+                std::println("invalid --rd value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--do", 0) == 0)
+        {
+            std::string val;
+            if (a == "--do"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 5 && a.substr(4, 1) == "="sv)
+                val = std::string(
+                    a.substr(5));
+            else
+            {
+                std::println("invalid --do usage");
+                return false;
+            }
+            if (val == "on" || val == "1" || val == "true") opt.do_bit = true;
+            else if (val == "off" || val == "0" || val ==
+                     "false")
+                opt.do_bit = false;
+            else
+            {
+                std::println("invalid --do value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--timeout", 0) == 0)
+        {
+            std::string val;
+            if (a == "--timeout"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 10 && a.substr(9, 1) ==
+                     "="sv)
+                val = std::string(a.substr(10));
+            else
+            {
+                std::println("invalid --timeout usage");
+                return false;
+            }
+            try { opt.timeout_ms = std::stoi(val); }
+            catch (...)
+            {
+                std::println("invalid --timeout value: {}", val);
+                return false;
+            }
+            if (opt.timeout_ms < 0) opt.timeout_ms = 0;
+        }
+        else if (a == "--tcp"sv)
+        {
+            opt.tcp = true;
+        }
+        else if (a.rfind("--edns-size", 0) == 0)
+        {
+            std::string val;
+            if (a == "--edns-size"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 12 && a.substr(11, 1) == "="sv)
+                val = std::string(a.substr(12));
+            else
+            {
+                std::println("invalid --edns-size usage");
+                return false;
+            }
+            try { opt.edns_size = std::stoi(val); }
+            catch (...) { opt.edns_size = -1; }
+            if (opt.edns_size < 512 || opt.edns_size > 65535)
+            {
+                std::println("invalid --edns-size value: {}", val);
+                return false;
+            }
+        }
+        else if (a == "--cookie"sv)
+        {
+            opt.cookie = true;
+        }
+        else if (a == "--0x20"sv)
+        {
+            opt.case_0x20 = true;
+        }
+        else if (a == "--pin"sv)
+        {
+            opt.pin = true;
+        }
+        else if (a == "--busy-poll"sv)
+        {
+            opt.busy_poll = 0;
+        }
+        else if (a.starts_with("--busy-poll="))
+        {
+            std::string val(a.substr(12));
+            try { opt.busy_poll = std::stoi(val); }
+            catch (...) { opt.busy_poll = -1; }
+            if (opt.busy_poll < 0 || opt.busy_poll > 1'000'000)
+            {
+                std::println("invalid --busy-poll value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--source-addrs", 0) == 0)
+        {
+            std::string val;
+            if (a == "--source-addrs"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 15 && a.substr(14, 1) == "="sv)
+                val = std::string(a.substr(15));
+            else
+            {
+                std::println("invalid --source-addrs usage");
+                return false;
+            }
+            std::istringstream is(val);
+            std::string        ip;
+            while (std::getline(is, ip, ','))
+            {
+                sockaddr_storage ss;
+                socklen_t        len;
+                if (ip.empty()) continue;
+                if (!parse_source_ip(ip, ss, len))
+                {
+                    std::println("invalid --source-addrs value: {}", ip);
+                    return false;
+                }
+                opt.source_addrs.push_back(ip);
+            }
+            if (opt.source_addrs.empty())
+            {
+                std::println("invalid --source-addrs value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--source-ports", 0) == 0)
+        {
+            std::string val;
+            if (a == "--source-ports"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 15 && a.substr(14, 1) == "="sv)
+                val = std::string(a.substr(15));
+            else
+            {
+                std::println("invalid --source-ports usage");
+                return false;
+            }
+            if (!parse_port_range(val, opt.source_port_lo, opt.source_port_hi))
+            {
+                std::println("invalid --source-ports value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--source-order", 0) == 0)
+        {
+            std::string val;
+            if (a == "--source-order"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 15 && a.substr(14, 1) == "="sv)
+                val = std::string(a.substr(15));
+            else
+            {
+                std::println("invalid --source-order usage");
+                return false;
+            }
+            if (val != "rr" && val != "hash")
+            {
+                std::println("invalid --source-order value: {}", val);
+                return false;
+            }
+            opt.source_hash = val == "hash";
+        }
+        else if (a.rfind("--workers", 0) == 0)
+        {
+            std::string val;
+            if (a == "--workers"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 10 && a.substr(9, 1) == "="sv)
+                val = std::string(a.substr(10));
+            else
+            {
+                std::println("invalid --workers usage");
+                return false;
+            }
+            try { opt.workers = std::stoi(val); }
+            catch (...) { opt.workers = -1; }
+            if (opt.workers < 1 || opt.workers > 1024)
+            {
+                std::println("invalid --workers value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--procs", 0) == 0)
+        {
+            std::string val;
+            if (a == "--procs"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 8 && a.substr(7, 1) == "="sv)
+                val = std::string(a.substr(8));
+            else
+            {
+                std::println("invalid --procs usage");
+                return false;
+            }
+            try { opt.procs = std::stoi(val); }
+            catch (...) { opt.procs = -1; }
+            if (opt.procs < 1 || opt.procs > 256)
+            {
+                std::println("invalid --procs value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--warmup", 0) == 0)
+        {
+            std::string val;
+            if (a == "--warmup"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 9 && a.substr(8, 1) == "="sv)
+                val = std::string(a.substr(9));
+            else
+            {
+                std::println("invalid --warmup usage");
+                return false;
+            }
+            if (!parse_warmup(val, opt))
+            {
+                std::println("invalid --warmup value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--ci", 0) == 0 &&
+                 (a.size() == 4 || a[4] == '='))
+        {
+            std::string val;
+            if (a == "--ci"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 5) val = std::string(a.substr(5));
+            else
+            {
+                std::println("invalid --ci usage");
+                return false;
+            }
+            try { opt.ci_level = std::stod(val); }
+            catch (...) { opt.ci_level = 0; }
+            if (!(opt.ci_level >= 50 && opt.ci_level < 100))
+            {
+                std::println("invalid --ci value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--sample", 0) == 0)
+        {
+            std::string val;
+            if (a == "--sample"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 9 && a.substr(8, 1) == "="sv)
+                val = std::string(a.substr(9));
+            else
+            {
+                std::println("invalid --sample usage");
+                return false;
+            }
+            if (!parse_sample(val, opt))
+            {
+                std::println("invalid --sample value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--capture-slow", 0) == 0)
+        {
+            std::string val;
+            if (a == "--capture-slow"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 15 && a.substr(14, 1) == "="sv)
+                val = std::string(a.substr(15));
+            else
+            {
+                std::println("invalid --capture-slow usage");
+                return false;
+            }
+            // pN, or a latency in ms (an ms suffix is optional)
+            std::string_view v = val;
+            bool             ok;
+            if (v.starts_with('p'))
+            {
+                auto rc = std::from_chars(v.data() + 1, v.data() + v.size(),
+                                          opt.capture_pctl);
+                ok = rc.ec == std::errc() && rc.ptr == v.data() + v.size() &&
+                     opt.capture_pctl >= 1 && opt.capture_pctl <= 99;
+            }
+            else
+            {
+                if (v.ends_with("ms")) v.remove_suffix(2);
+                auto rc = std::from_chars(v.data(), v.data() + v.size(),
+                                          opt.capture_ms);
+                ok = rc.ec == std::errc() && rc.ptr == v.data() + v.size() &&
+                     opt.capture_ms > 0;
+            }
+            if (!ok)
+            {
+                std::println("invalid --capture-slow value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--capture-rest", 0) == 0)
+        {
+            std::string val;
+            if (a == "--capture-rest"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 15 && a.substr(14, 1) == "="sv)
+                val = std::string(a.substr(15));
+            else
+            {
+                std::println("invalid --capture-rest usage");
+                return false;
+            }
+            if (val == "compact") opt.capture_none = false;
+            else if (val == "none") opt.capture_none = true;
+            else
+            {
+                std::println("invalid --capture-rest value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--compress", 0) == 0)
+        {
+            std::string val;
+            if (a == "--compress"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 11 && a.substr(10, 1) == "="sv)
+                val = std::string(a.substr(11));
+            else
+            {
+                std::println("invalid --compress usage");
+                return false;
+            }
+            if (!parse_compress(val, opt.compress_level))
+            {
+                std::println("invalid --compress value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--sweep-step", 0) == 0)
+        {
+            std::string val;
+            if (a == "--sweep-step"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 13 && a.substr(12, 1) == "="sv)
+                val = std::string(a.substr(13));
+            else
+            {
+                std::println("invalid --sweep-step usage");
+                return false;
+            }
+            if (!parse_duration_ms(val, opt.sweep_step_ms) ||
+                opt.sweep_step_ms < 100)
+            {
+                std::println("invalid --sweep-step value: {}", val);
+                return false;
+            }
+        }
+        else if (a.rfind("--sweep", 0) == 0)
+        {
+            std::string val;
+            if (a == "--sweep"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 8 && a.substr(7, 1) == "="sv)
+                val = std::string(a.substr(8));
+            else
+            {
+                std::println("invalid --sweep usage");
+                return false;
+            }
+            if (!parse_sweep(val, opt))
+            {
+                std::println("invalid --sweep value: {}", val);
                 return false;
             }
         }
-        else if (a.rfind("--do", 0) == 0)
+        else if (a == "--until-stable"sv)
         {
-            std::string val;
-            if (a == "--do"sv && i + 1 < argc) val = argv[++i];
-            else if (a.size() > 5 && a.substr(4, 1) == "="sv)
-                val = std::string(
-                    a.substr(5));
-            else
+            opt.stable_pctl = 99;
+        }
+        else if (a.starts_with("--until-stable="))
+        {
+            // P[:W], P may carry a leading 'p'
+            std::string val(a.substr(15));
+            std::string spec = val.starts_with('p') ? val.substr(1) : val;
+            auto        colon = spec.find(':');
+            try
             {
-                std::println("invalid --do usage");
-                return false;
+                size_t used   = 0;
+                opt.stable_pctl = std::stoi(spec.substr(0, colon), &used);
+                if (used != std::min(colon, spec.size())) opt.stable_pctl = 0;
+                if (colon != std::string::npos)
+                    opt.stable_width = std::stod(spec.substr(colon + 1));
             }
-            if (val == "on" || val == "1" || val == "true") opt.do_bit = true;
-            else if (val == "off" || val == "0" || val ==
-                     "false")
-                opt.do_bit = false;
-            else
+            catch (...) { opt.stable_pctl = 0; }
+            if (opt.stable_pctl < 1 || opt.stable_pctl > 99 ||
+                !(opt.stable_width > 0))
             {
-                std::println("invalid --do value: {}", val);
+                std::println("invalid --until-stable value: {}", val);
                 return false;
             }
         }
-        else if (a.rfind("--timeout", 0) == 0)
+        else if (a.rfind("--padding", 0) == 0)
         {
             std::string val;
-            if (a == "--timeout"sv && i + 1 < argc) val = argv[++i];
-            else if (a.size() > 10 && a.substr(9, 1) ==
-                     "="sv)
+            if (a == "--padding"sv && i + 1 < argc) val = argv[++i];
+            else if (a.size() > 10 && a.substr(9, 1) == "="sv)
                 val = std::string(a.substr(10));
             else
             {
-                std::println("invalid --timeout usage");
+                std::println("invalid --padding usage");
                 return false;
             }
-            try { opt.timeout_ms = std::stoi(val); }
-            catch (...)
+            try { opt.padding = std::stoi(val); }
+            catch (...) { opt.padding = -1; }
+            if (opt.padding < 1 || opt.padding > 1024)
             {
-                std::println("invalid --timeout value: {}", val);
+                std::println("invalid --padding value: {}", val);
                 return false;
             }
-            if (opt.timeout_ms < 0) opt.timeout_ms = 0;
-        }
-        else if (a == "--tcp"sv)
-        {
-            opt.tcp = true;
         }
         else if (!a.empty() && a[0] == '-')
         {
@@ -848,10 +6341,161 @@ static bool parse_args(int argc, char **argv, Options &opt)
         }
         else
         {
-            opt.host = std::string(a);
+            opt.hosts.emplace_back(a);
+        }
+    }
+    if (!opt.hosts_file.empty() && !load_list_file(opt.hosts_file, opt.hosts))
+    {
+        std::println("cannot read hosts file: {}", opt.hosts_file);
+        return false;
+    }
+    // De-duplicate, keeping first occurrence order. uniq never reallocates,
+    // so the views in seen stay valid.
+    std::unordered_set<std::string_view> seen;
+    std::vector<std::string>             uniq;
+    uniq.reserve(opt.hosts.size());
+    for (auto &h: opt.hosts)
+    {
+        if (seen.contains(h)) continue;
+        uniq.push_back(std::move(h));
+        seen.insert(uniq.back());
+    }
+    opt.hosts = std::move(uniq);
+    if (opt.hosts.empty()) return false;
+    if (!opt.ecs_file.empty())
+    {
+        std::vector<std::string> lines;
+        if (!load_list_file(opt.ecs_file, lines))
+        {
+            std::println("cannot read ECS list: {}", opt.ecs_file);
+            return false;
+        }
+        for (const auto &l: lines)
+        {
+            int                           af = 0, prefix = 0;
+            std::array<unsigned char, 16> addr{};
+            if (!parse_cidr(l, af, addr, prefix))
+            {
+                std::println("invalid subnet in {}: {}", opt.ecs_file, l);
+                return false;
+            }
+            opt.ecs.push_back(make_ecs(af, addr, prefix));
+        }
+    }
+    if (!opt.ecs_range.empty() && !expand_ecs_range(opt.ecs_range, opt.ecs))
+    {
+        std::println("invalid --ecs-range value: {}", opt.ecs_range);
+        return false;
+    }
+    if (!opt.ecs.empty() && opt.qtype.empty())
+    {
+        std::println("--ecs-list/--ecs-range need raw mode (--type)");
+        return false;
+    }
+    if (opt.qtype.empty())
+    {
+        // Read from (or sent in) raw DNS messages only
+        const char *raw_only = nullptr;
+        if (opt.cache_stats) raw_only = "--cache-stats";
+        else if (opt.cookie) raw_only = "--cookie";
+        else if (opt.nsid) raw_only = "--nsid";
+        else if (opt.padding) raw_only = "--padding";
+        if (raw_only)
+        {
+            std::println("{} needs raw mode (--type)", raw_only);
+            return false;
+        }
+    }
+    if (opt.busy_poll >= 0 && (opt.qtype.empty() || opt.tcp))
+    {
+        std::println("--busy-poll needs raw UDP mode (--type without --tcp)");
+        return false;
+    }
+    if (opt.busy_poll >= 0) opt.pin = true; // a spinning worker owns its CPU
+    if ((!opt.source_addrs.empty() || opt.source_port_lo) &&
+        (opt.qtype.empty() || opt.tcp))
+    {
+        std::println(
+            "--source-addrs/--source-ports need raw UDP mode (--type without --tcp)");
+        return false;
+    }
+    // Each process sees only its own attempts; the merged summary is built
+    // from the shared latency and result counters
+    if (opt.procs > 1)
+    {
+        const char *clash = nullptr;
+        if (opt.answer_sets) clash = "--answer-sets";
+        else if (opt.cache_stats) clash = "--cache-stats";
+        else if (opt.busy_poll >= 0) clash = "--busy-poll";
+        else if (!opt.source_addrs.empty() || opt.source_port_lo)
+            clash = "--source-addrs/--source-ports";
+        else if (opt.stable_pctl) clash = "--until-stable";
+        if (clash)
+        {
+            std::println("--procs cannot be combined with {}", clash);
+            return false;
+        }
+    }
+    if ((opt.sample_every || opt.sample_below != UINT64_MAX) && !opt.ndjson)
+    {
+        std::println("--sample needs --ndjson");
+        return false;
+    }
+    if ((opt.capture_ms > 0 || opt.capture_pctl) &&
+        (opt.qtype.empty() || !opt.ndjson))
+    {
+        std::println("--capture-slow needs raw mode (--type) and --ndjson");
+        return false;
+    }
+    // A sweep step runs for its time, with --tries as a cap on its attempts
+    // (a million over all targets by default). The engine is sized for the
+    // largest concurrency step; rate steps keep up to --concurrency attempts
+    // in flight (256 by default).
+    if (!opt.sweep.empty())
+    {
+        const char *clash = nullptr;
+        if (opt.qtype.empty() || opt.tcp)
+        {
+            std::println("--sweep needs raw UDP mode (--type without --tcp)");
+            return false;
+        }
+        // Each step drains before the next, which unanswered queries with no
+        // timeout would never do
+        if (opt.timeout_ms <= 0)
+        {
+            std::println("--sweep needs --timeout above 0");
+            return false;
+        }
+        if (opt.procs > 1) clash = "--procs";
+        else if (opt.live) clash = "--live";
+        else if (opt.stable_pctl) clash = "--until-stable";
+        else if (opt.warmup_n || opt.warmup_ms > 0) clash = "--warmup";
+        else if (opt.busy_poll >= 0) clash = "--busy-poll";
+        else if (opt.answer_sets) clash = "--answer-sets";
+        else if (opt.cache_stats) clash = "--cache-stats";
+        else if (!opt.hist_out.empty()) clash = "--hist-out";
+        else if (opt.ci_level) clash = "--ci";
+        else if (opt.capture_ms > 0 || opt.capture_pctl) clash = "--capture-slow";
+        else if (opt.sample_every || opt.sample_below != UINT64_MAX)
+            clash = "--sample";
+        if (clash)
+        {
+            std::println("--sweep cannot be combined with {}", clash);
+            return false;
         }
+        if (!tries_set)
+            opt.tries = static_cast<int>(std::max<size_t>(
+                1,
+                1'000'000 / (opt.hosts.size() * std::max<size_t>(1, opt.ecs.size()))));
+        if (!opt.sweep_rate) opt.concurrency = std::ranges::max(opt.sweep);
+        else if (!concurrency_set) opt.concurrency = 256;
+    }
+    if (source_count(opt) > 4096)
+    {
+        std::println("too many sources: {} (at most 4096)", source_count(opt));
+        return false;
     }
-    if (opt.host.empty()) return false;
+    opt.host = opt.hosts.front();
     return true;
 }
 
@@ -863,6 +6507,14 @@ int main(int argc, char **argv)
         print_usage(argv[0]);
         return 0;
     }
+    if (argv[1] == "merge"sv) return run_merge(argv[0], argc - 1, argv + 1);
+    if (argv[1] == "compare"sv)
+        return run_compare(argv[0], argc - 1, argv + 1);
+    if (argv[1] == "analyze"sv)
+        return run_analyze(argv[0], argc - 1, argv + 1);
+    if (argv[1] == "bench-timers"sv)
+        return run_bench_timers(argv[0], argc - 1, argv + 1);
+    if (argv[1] == "serve"sv) return run_serve(argv[0], argc - 1, argv + 1);
     if (!parse_args(argc, argv, opt))
     {
         if (opt.host.empty())
@@ -871,10 +6523,73 @@ int main(int argc, char **argv)
         }
         return 1;
     }
+    // Before anything is printed or forked; the last frame is written when
+    // main returns
+    StdoutCompressor compressor;
+    if (opt.compress_level)
+    {
+        // Exit 3 tells a missing library apart from a usage error
+        if (!zstd_api(&compressor.error))
+        {
+            std::println(stderr, "--compress: {}", compressor.error);
+            return 3;
+        }
+        if (!compressor.start(opt.compress_level))
+        {
+            std::println(stderr, "--compress: {}", compressor.error);
+            return 1;
+        }
+    }
+
+    // Attempts run try-major over the host list: attempt g (1-based) is try
+    // (g-1)/H+1 of host (g-1)%H, so concurrent workers spread across names.
+    // Every (host, subnet) pair is a target; tries run over all targets
+    const int  n_hosts    = static_cast<int>(opt.hosts.size());
+    const int  n_subnets  = std::max(1, static_cast<int>(opt.ecs.size()));
+    // Attempts are numbered by int; --ecs-range alone allows 2^20 subnets
+    if (int64_t{opt.tries} * n_hosts * n_subnets > std::numeric_limits<int>::max())
+    {
+        std::println("too many attempts: {} tries x {} hosts x {} subnets",
+                     opt.tries,
+                     n_hosts,
+                     n_subnets);
+        return 1;
+    }
+    const int  n_targets  = n_hosts * n_subnets;
+    const int  total      = opt.tries * n_targets;
+    const bool multi_host = n_hosts > 1;
+    const bool raw_mode   = !opt.qtype.empty();
+    // Raw UDP workers are event loops that each keep a window of attempts in
+    // flight over sockets of their own, so one per CPU is enough; --tcp and
+    // getaddrinfo attempts block, one per worker thread
+    const bool raw_async = raw_mode && !opt.tcp;
+    int        workers   = std::min(opt.concurrency, total);
+    if (raw_async)
+        workers = std::min(workers,
+                           opt.workers
+                               ? opt.workers
+                               : static_cast<int>(std::max(
+                                   1u,
+                                   std::thread::hardware_concurrency())));
+    // Bound sources are split over the workers, so none may be left without
+    const size_t n_sources = !opt.source_addrs.empty() || opt.source_port_lo
+                                 ? source_count(opt)
+                                 : 0;
+    if (n_sources)
+        workers = std::min(workers, static_cast<int>(n_sources));
+    // --concurrency split over the raw UDP workers: the first K % workers
+    // take one more, so no more than K are ever in flight
+    const int in_flight = std::min(opt.concurrency, total);
+    auto      window_of = [&](int w)
+    {
+        return in_flight / workers + (w < in_flight % workers ? 1 : 0);
+    };
 
-    if (!opt.json && !opt.ndjson)
+    if (!opt.json && !opt.ndjson && !opt.live)
     {
-        std::println("Resolving: {}", opt.host);
+        if (multi_host)
+            std::println("Resolving: {} hosts ({}, ...)", n_hosts, opt.host);
+        else std::println("Resolving: {}", opt.host);
         std::println(
             "Family: {}  Tries: {}",
             opt.family == Family::Any
@@ -902,6 +6617,10 @@ int main(int argc, char **argv)
             opt.concurrency,
             opt.json ? "on" : "off",
             opt.dedup ? "on" : "off");
+        if (opt.procs > 1)
+            std::println("Procs: {} processes x {} workers, tries split between them",
+                         opt.procs,
+                         workers);
         if (!opt.qtype.empty())
         {
             std::println(
@@ -912,89 +6631,332 @@ int main(int argc, char **argv)
                 opt.do_bit ? "on" : "off",
                 opt.timeout_ms,
                 opt.tcp ? "on" : "off");
+            std::println("EDNS: size={} cookie={} nsid={} padding={}",
+                         opt.edns_size,
+                         opt.cookie ? "on" : "off",
+                         opt.nsid ? "on" : "off",
+                         opt.padding ? std::to_string(opt.padding) : "off");
+            if (raw_async)
+                std::println(
+                    "Engine: {} UDP workers x {} in flight, pin={} busy-poll={}",
+                    workers,
+                    in_flight % workers
+                        ? std::format("{}-{}", window_of(workers - 1), window_of(0))
+                        : std::to_string(window_of(0)),
+                    opt.pin ? "on" : "off",
+                    opt.busy_poll < 0
+                        ? "off"
+                        : opt.busy_poll == 0
+                              ? "spin"
+                              : std::format("spin+SO_BUSY_POLL {}us",
+                                            opt.busy_poll));
+            if (!opt.sweep.empty())
+            {
+                std::string steps;
+                for (int v: opt.sweep)
+                    steps += (steps.empty() ? "" : ",") + std::to_string(v);
+                std::println("Sweep: {} {} ({:.1f} s per step, at most {} tries each)",
+                             opt.sweep_rate ? "rate" : "concurrency",
+                             steps,
+                             opt.sweep_step_ms / 1000,
+                             total);
+            }
+            if (n_sources)
+                std::println("Sources: {} ({} addresses x {} ports), order={}",
+                             n_sources,
+                             std::max<size_t>(1, opt.source_addrs.size()),
+                             n_sources / std::max<size_t>(
+                                 1, opt.source_addrs.size()),
+                             opt.source_hash ? "hash" : "rr");
+            if (!opt.ecs.empty())
+                std::println("ECS: {} subnets ({}, ...)",
+                             opt.ecs.size(),
+                             opt.ecs.front().text);
         }
     }
 
-    std::vector<double> times;
-    times.assign(opt.tries, 0);
-    std::vector<AttemptResult> attempts(opt.json ? opt.tries : 0);
-
-    auto attempt_fn = [&](int t)
+    // --procs: fork the worker processes over a shared stats region. The
+    // parent only watches and summarises; each child carries on below over
+    // its own slice [first_try, last_try] of the attempts.
+    std::optional<SharedStats> shared;
+    int                        proc      = 0;
+    int                        first_try = 1, last_try = total;
+    if (opt.procs > 1)
     {
-        // Raw DNS path: if --type is specified, use ldns when available
-        if (!opt.qtype.empty())
+        shared.emplace(opt.procs, workers);
+        if (!shared->ok())
         {
-            auto                 t0 = std::chrono::steady_clock::now();
-            double               ms = 0.0;
-            [[maybe_unused]] int rc = -1;
-
-#ifdef HAVE_LDNS
-            ldns_resolver *res = nullptr;
-            ldns_status    st  = LDNS_STATUS_OK;
-            // Build resolver either from resolv.conf or custom ns
-            if (opt.ns.empty())
+            std::println(stderr, "cannot map shared stats: {}", std::strerror(errno));
+            return 1;
+        }
+        std::fflush(stdout);
+        std::vector<pid_t> kids;
+        bool               child = false;
+        for (int p = 0; p < opt.procs && !child; ++p)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
             {
-                st = ldns_resolver_new_frm_file(&res, nullptr);
+                child = true;
+                proc  = p;
             }
+            else if (pid > 0) kids.push_back(pid);
             else
             {
-                res = ldns_resolver_new();
-                if (res)
-                {
-                    // push nameserver from string (A/AAAA only)
-                    ldns_rdf *ns_rdf = nullptr;
-                    // Try IPv6 first if ':' present
-                    if (opt.ns.find(':') != std::string::npos)
-                    {
-                        ns_rdf = ldns_rdf_new_frm_str(
-                            LDNS_RDF_TYPE_AAAA,
-                            opt.ns.c_str());
-                    }
-                    else
-                    {
-                        ns_rdf = ldns_rdf_new_frm_str(
-                            LDNS_RDF_TYPE_A,
-                            opt.ns.c_str());
-                    }
-                    if (ns_rdf)
-                    {
-                        (void) ldns_resolver_push_nameserver(res, ns_rdf);
-                        ldns_rdf_deep_free(ns_rdf);
-                    }
-                    else
-                    {
-                        // cannot parse nameserver string
-                        st = LDNS_STATUS_SYNTAX_RDATA_ERR;
-                    }
-                }
+                std::println(stderr, "fork: {}", std::strerror(errno));
+                for (pid_t k: kids) kill(k, SIGTERM);
+                for (pid_t k: kids) waitpid(k, nullptr, 0);
+                return 1;
+            }
+        }
+        if (!child) return run_procs_parent(opt, *shared, kids, total, raw_async);
+        first_try = static_cast<int>(static_cast<int64_t>(total) * proc /
+                                     opt.procs) + 1;
+        last_try = static_cast<int>(static_cast<int64_t>(total) * (proc + 1) /
+                                    opt.procs);
+        opt.live = false;
+        // Whole lines per write, so the children's output does not interleave
+        std::setvbuf(stdout, nullptr, _IOLBF, 0);
+    }
+
+    // --sweep prints a row (or NDJSON line) per step, or one JSON object at
+    // the end; the tries themselves print nothing, as under --live
+    const bool sweep_json   = opt.json;
+    const bool sweep_ndjson = opt.ndjson;
+    if (!opt.sweep.empty()) opt.json = opt.ndjson = false;
+    const bool quiet = opt.live || !opt.sweep.empty();
+
+    // Per-attempt arrays cover this process's slice of the tries only
+    // (all of them without --procs): attempt g is at g - first_try
+    const int           n_slice = last_try - first_try + 1;
+    std::vector<double> times;
+    times.assign(n_slice, 0);
+    // rc != 0 per attempt, and the DNS rcode of raw replies (-1 otherwise);
+    // the worker folds both into its stats shard after each attempt
+    std::vector<unsigned char> failed(n_slice, 0);
+    // Whether each attempt ran, and whether it counts or was --warmup
+    std::vector<Phase> phase(n_slice, Phase::NotRun);
+    std::vector<signed char>   rcodes(n_slice, -1);
+    std::vector<AttemptResult> attempts(opt.json ? n_slice : 0);
+    HostTable                  host_stats(multi_host ? opt.hosts.size() : 0);
+    // ECS runs: per-subnet latency and the scope prefix each reply carried
+    HostTable                subnet_stats(opt.ecs.size());
+    std::vector<int16_t>     ecs_scope(opt.ecs.empty() ? 0 : n_slice, -1); // 0..128
+    // Per-worker answer-set trackers, merged after the workers finish
+    std::vector<AnswerSets> answer_sets(opt.answer_sets ? workers : 0);
+    // NSID of the instance that answered each attempt (--nsid)
+    std::vector<std::string> nsids(opt.nsid ? n_slice : 0);
+    // Raw mode: minimum answer TTL (-1 if none), send time, and transport
+    // details per attempt
+    std::vector<int64_t>         ttls(raw_mode ? n_slice : 0, -1);
+    std::vector<double>          starts(raw_mode && opt.cache_stats ? n_slice : 0, 0);
+    std::vector<TransportRecord> transport(raw_mode ? n_slice : 0);
+    // One wire template per target; an empty wire marks an invalid qname
+    std::vector<QueryTemplate> templates(raw_mode ? n_targets : 0);
+    if (raw_mode)
+    {
+        const uint16_t qtype = qtype_code(opt.qtype);
+        for (int k = 0; k < n_targets; ++k)
+            build_query_template(opt.hosts[k % n_hosts],
+                                 qtype,
+                                 opt,
+                                 opt.ecs.empty() ? nullptr : &opt.ecs[k / n_hosts],
+                                 templates[k]);
+    }
+    // --tcp attempts' DNS cookie, per worker: a random client cookie,
+    // followed by the last server cookie once one has been returned, which
+    // the worker's next queries echo back. Raw UDP keeps one per socket.
+    std::vector<std::string>  cookies(opt.cookie ? workers : 0);
+    std::vector<QueryScratch> scratch(raw_mode ? workers : 0);
+    // --sample: each worker's own draw for whether an attempt writes a line
+    std::vector<LineSampler> samplers(opt.ndjson ? workers : 0);
+    {
+        std::random_device rd;
+        for (auto &c: cookies)
+            for (size_t i = 0; i < kClientCookieLen; ++i)
+                c += static_cast<char>(rd() & 0xff);
+        for (auto &ls: samplers) ls.state = static_cast<uint64_t>(rd()) << 32 | rd();
+        for (auto &sc: scratch)
+        {
+            sc.rng = static_cast<uint64_t>(rd()) << 32 | rd();
+            sc.rx.resize(kMaxMessage);
+        }
+    }
+    // Raw mode talks to one server, resolved once; the RR sections of a reply
+    // are only walked when some output or summary needs them, so JSON and
+    // --live runs stop at the header and question
+    sockaddr_storage server{};
+    socklen_t        server_len = 0;
+    const bool       server_ok  = raw_mode &&
+                           resolve_nameserver(opt.ns, server, server_len);
+    // --source-addrs / --source-ports: every source is bound up front, so a
+    // bad address or a port in use stops the run before it starts
+    std::string             source_err;
+    std::vector<SourceAddr> sources =
+            server_ok
+                ? expand_sources(opt, server.ss_family, source_err)
+                : std::vector<SourceAddr>{};
+    std::vector<int> source_fds;
+    for (const auto &src: sources)
+    {
+        int fd = open_source_socket(src, server, server_len, source_err);
+        if (fd < 0) break;
+        source_fds.push_back(fd);
+    }
+    if (!source_err.empty())
+    {
+        std::println("{}", source_err);
+        for (int fd: source_fds) close(fd);
+        return 1;
+    }
+    // Per-source latency, and the source each attempt left from
+    HostTable             source_stats(sources.size());
+    std::vector<uint32_t> attempt_src(sources.empty() ? 0 : n_slice, 0);
+    const bool rrs_for_stats = opt.answer_sets || opt.cache_stats ||
+                               !opt.ecs.empty() || opt.nsid || opt.cookie;
+    const bool need_rrs = opt.ndjson || (!opt.json && !quiet) || rrs_for_stats;
+    auto cookie_for = [&](int w) -> const std::string &
+    {
+        static const std::string kNoCookie;
+        return opt.cookie ? cookies[w] : kNoCookie;
+    };
+    // Stray replies dropped and UDP sockets opened by the raw workers
+    std::atomic<uint64_t> raw_stray{0}, raw_sockets{0};
+    // Raw UDP tries that never went out: no usable nameserver or qname, no
+    // socket or ID to send from, or a failed send
+    std::atomic<uint64_t> raw_unsent{0};
+    std::atomic<bool>     busy_poll_warned{false};
+    const auto            run_t0 = std::chrono::steady_clock::now();
+    // --warmup: the first N attempts of this process, or those started in
+    // the first MS of the run
+    auto is_warmup = [&](int g, std::chrono::steady_clock::time_point started)
+    {
+        return g - first_try < opt.warmup_n ||
+               std::chrono::duration<double, std::milli>(started - run_t0)
+               .count() < opt.warmup_ms;
+    };
+    // --until-stable: set once the watched percentile is stable; workers
+    // stop claiming tries
+    std::atomic<bool> stop_run{false};
+    // --sweep: workers meet the coordinator at this barrier twice a step,
+    // to start at sweep_t0 and once drained
+    std::barrier<>                        sweep_sync(opt.sweep.empty() ? 1 : workers + 1);
+    std::chrono::steady_clock::time_point sweep_t0;
+
+    // Each worker owns one stats shard; a --procs child's shards are its
+    // block of the shared region
+    std::vector<StatsShard> local_shards(shared ? 0 : workers);
+    std::span<StatsShard>   shards = shared
+                                         ? shared->of(proc)
+                                         : std::span<StatsShard>(local_shards);
+    // --capture-slow: only fully recorded attempts need their RRs walked
+    // for output
+    const bool capture = opt.capture_ms > 0 || opt.capture_pctl;
+
+    // done: a raw UDP attempt whose exchange raw_loop has already finished
+    auto attempt_fn = [&](int g, int w, RawOutcome *done = nullptr)
+    {
+        const int          target = (g - 1) % n_targets;
+        const std::string &host   = opt.hosts[target % n_hosts];
+        const EcsSubnet *  ecs    = opt.ecs.empty()
+                                        ? nullptr
+                                        : &opt.ecs[target / n_hosts];
+        const int t = (g - 1) / n_targets + 1;
+        // Only multi-host and ECS runs tag output with the target
+        std::string tag = multi_host ? host : std::string();
+        if (ecs) tag += (tag.empty() ? "ecs=" : " ecs=") + ecs->text;
+        if (!tag.empty()) tag = "[" + tag + "] ";
+        // Warmup attempts are tagged as well, right after rc where the
+        // re-analysis readers look for it
+        const bool warm = is_warmup(
+            g, done ? done->t0 : std::chrono::steady_clock::now());
+        std::string host_field = warm ? R"(,"warmup":true)" : "";
+        if (multi_host) host_field += R"(,"host":")" + json_escape(host) + "\"";
+        if (ecs) host_field += R"(,"ecs":")" + ecs->text + "\"";
+        // --sample: whether this attempt writes its NDJSON line
+        const bool line = !opt.ndjson || samplers[w].take(g, n_targets, opt);
+        phase[g - first_try] = warm ? Phase::Warmup : Phase::Measured;
+        if (warm) tag = "(warmup) " + tag;
+
+        // Raw DNS path: if --type is specified, query the server directly.
+        // UDP attempts arrive here from raw_loop with the exchange done; a
+        // --tcp attempt makes its one blocking exchange now.
+        if (raw_mode)
+        {
+            const QueryTemplate &tpl = templates[target];
+            QueryScratch &       qs  = scratch[w];
+            RawOutcome           tcp_done;
+            RawOutcome &         o = done ? *done : tcp_done;
+            if (!done)
+            {
+                o.t0   = std::chrono::steady_clock::now();
+                o.wire = &qs.wire;
+                if (!server_ok) o.err = "invalid nameserver";
+                else if (tpl.wire.empty()) o.err = "invalid qname";
                 else
                 {
-                    st = LDNS_STATUS_MEM_ERR;
+                    const std::string &cookie = cookie_for(w);
+                    o.cookie_sent = cookie.size() > kClientCookieLen;
+                    patch_query(tpl,
+                                opt,
+                                cookie,
+                                static_cast<uint16_t>(next_random(qs.rng)),
+                                qs.rng,
+                                qs.wire);
+                    ssize_t n = tcp_exchange(server,
+                                             server_len,
+                                             wire_bytes(qs.wire),
+                                             qs.rx,
+                                             opt.timeout_ms,
+                                             o.err);
+                    if (n > 0)
+                        o.reply = std::span<const uint8_t>(qs.rx).first(
+                            static_cast<size_t>(n));
                 }
             }
-            if (st != LDNS_STATUS_OK || !res)
+            if (!starts.empty())
+                starts[g - first_try] = std::chrono::duration<double, std::milli>(
+                    o.t0 - run_t0).count();
+            double ms = std::chrono::duration<double, std::milli>(
+                (o.rx_at != std::chrono::steady_clock::time_point{}
+                     ? o.rx_at
+                     : std::chrono::steady_clock::now()) - o.t0).count();
+            times[g - first_try] = ms;
+            // --capture-slow: errors and attempts over the threshold get the
+            // full record whether or not --sample picked them; the rest a
+            // compact one, or none.
+            const bool full = capture ? ms > capture_threshold(opt, shards[w], qs)
+                                      : line;
+
+            auto raw_error = [&](std::string err)
             {
-                auto t1e = std::chrono::steady_clock::now();
-                ms       = std::chrono::duration<double, std::milli>(t1e - t0).
-                        count();
-                times[t - 1]    = ms;
-                std::string err = "ldns_resolver init failed";
+                failed[g - first_try] = 1;
                 if (opt.ndjson)
                 {
-                    std::ostringstream os;
-                    os << std::fixed << std::setprecision(3);
-                    os << "{";
-                    os << "\"try\":" << t << ",\"ms\":" << ms << ",\"rc\":-1";
-                    os << R"(,"error":")" << json_escape(err) << R"(")";
-                    os << R"(,"raw_dns":{"type":")" << json_escape(opt.qtype) <<
-                            R"(","ns":")" << json_escape(opt.ns)
-                            << R"(","rd":)" << (opt.rd ? "true" : "false") <<
-                            R"(,"do":)" << (opt.do_bit ? "true" : "false")
-                            << R"(,"timeout_ms":)" << opt.timeout_ms <<
-                            R"(,"tcp":)" << (opt.tcp ? "true" : "false") << "}";
-                    os << "}";
-                    std::scoped_lock lk(g_print_mtx);
-                    std::print("{}\n", os.str());
+                    if (line || capture)
+                    {
+                        std::ostringstream os;
+                        os << std::fixed << std::setprecision(3);
+                        os << "{";
+                        os << "\"try\":" << t << ",\"ms\":" << ms << ",\"rc\":-1" << host_field;
+                        os << R"(,"error":")" << json_escape(err) << R"(")";
+                        // The query settings, as the ldns path reported them
+                        os << R"(,"raw_dns":{"type":")" << json_escape(opt.qtype) <<
+                                R"(","ns":")" << json_escape(opt.ns)
+                                << R"(","rd":)" << (opt.rd ? "true" : "false") <<
+                                R"(,"do":)" << (opt.do_bit ? "true" : "false")
+                                << R"(,"timeout_ms":)" << opt.timeout_ms <<
+                                R"(,"tcp":)" << (opt.tcp ? "true" : "false") << "}";
+                        if (capture)
+                            put_capture_json(os,
+                                             o,
+                                             std::chrono::duration<double, std::milli>(
+                                                 o.t0 - run_t0).count(),
+                                             nullptr);
+                        os << '}';
+                        std::scoped_lock lk(g_print_mtx);
+                        std::print("{}\n", os.str());
+                    }
                 }
                 else if (opt.json)
                 {
@@ -1002,209 +6964,202 @@ int main(int argc, char **argv)
                     ar.ms           = ms;
                     ar.rc           = -1;
                     ar.error        = std::move(err);
-                    attempts[t - 1] = std::move(ar);
+                    attempts[g - first_try] = std::move(ar);
                 }
-                else
+                else if (!quiet)
                 {
                     std::scoped_lock lk(g_print_mtx);
                     std::println(
-                        "try {}: {:.3f} ms - raw DNS error: {}",
+                        "{}try {}: {:.3f} ms - raw DNS error: {}",
+                        tag,
                         t,
                         ms,
                         err);
                 }
-                if (res) ldns_resolver_deep_free(res);
-                return;
-            }
+            };
 
-            // Apply resolver settings
-            ldns_resolver_set_recursive(res, opt.rd);
-            ldns_resolver_set_usevc(res, opt.tcp);
-            ldns_resolver_set_fallback(res, true); // UDP->TCP fallback
-            if (opt.timeout_ms >= 0)
-            {
-                struct timeval tv{
-                    .tv_sec = opt.timeout_ms / 1000,
-                    .tv_usec = opt.timeout_ms % 1000 * 1000
-                };
-                ldns_resolver_set_timeout(res, tv);
-            }
-            // Prefer safe EDNS UDP size
-            ldns_resolver_set_edns_udp_size(res, 1232);
-            // Toggle the DO bit
-            ldns_resolver_set_dnssec(res, opt.do_bit);
-
-            // Build qname and type
-            ldns_rdf *name = ldns_dname_new_frm_str(opt.host.c_str());
-            if (!name)
-            {
-                auto t1e = std::chrono::steady_clock::now();
-                ms       = std::chrono::duration<double, std::milli>(t1e - t0).
-                        count();
-                times[t - 1]    = ms;
-                std::string err = "invalid qname";
-                if (opt.ndjson)
-                {
-                    std::ostringstream os;
-                    os << std::fixed << std::setprecision(3);
-                    os << "{";
-                    os << "\"try\":" << t << ",\"ms\":" << ms << ",\"rc\":-1";
-                    os << R"(,"error":")" << json_escape(err) << R"(")";
-                    os << R"(,"raw_dns":{"type":")" << json_escape(opt.qtype) <<
-                            R"("}})";
-                    std::scoped_lock lk(g_print_mtx);
-                    std::print("{}\n", os.str());
-                }
-                else if (opt.json)
-                {
-                    AttemptResult ar{};
-                    ar.ms           = ms;
-                    ar.rc           = -1;
-                    ar.error        = std::move(err);
-                    attempts[t - 1] = std::move(ar);
-                }
-                else
-                {
-                    std::scoped_lock lk(g_print_mtx);
-                    std::println(
-                        "try {}: {:.3f} ms - raw DNS error: invalid qname",
-                        t,
-                        ms);
-                }
-                ldns_resolver_deep_free(res);
+            // The reply must carry our ID and question (with --0x20, in the
+            // exact case pattern sent). Only then, and only if some output
+            // looks at records, are the RR sections walked.
+            std::string err = std::move(o.err);
+            ReplyView   reply{o.reply};
+            if (err.empty() && o.reply.empty())
+                err = o.mismatched ? "reply does not match query (id/0x20)"
+                                   : "timeout";
+            else if (err.empty() &&
+                     !reply.check(wire_bytes(*o.wire),
+                                  tpl.qname_len,
+                                  opt.case_0x20))
+                err = "reply does not match query (id/0x20)";
+            else if (err.empty() && need_rrs && (full || rrs_for_stats) &&
+                     !reply.index(tpl.qname_len))
+                err = "malformed reply";
+            if (!err.empty())
+            {
+                raw_error(std::move(err));
                 return;
             }
+            const size_t n           = o.reply.size();
+            const bool   cookie_sent = o.cookie_sent;
+            // Where the server cookie is kept: the UDP socket's (not after a
+            // TCP fallback, which left from another socket), or the worker's
+            std::string *jar = done ? done->cookie
+                                    : opt.cookie ? &cookies[w] : nullptr;
+            const bool   truncated   = o.truncated;
+            const bool   fell_back   = o.fell_back;
+            const double udp_ms      = o.udp_ms;
+            const double tcp_ms      = o.tcp_ms;
+            const size_t udp_size    = o.udp_size;
 
-            ldns_rr_type qtype = ldns_get_rr_type_by_name(opt.qtype.c_str());
-            if (qtype == 0)
-            {
-                // fallback for unknown string
-                // minimal mapping for common types
-                static const std::pair<std::string_view, ldns_rr_type> kTypeMap
-                        [] = {
-                            {"A", LDNS_RR_TYPE_A},
-                            {"AAAA", LDNS_RR_TYPE_AAAA},
-                            {"CNAME", LDNS_RR_TYPE_CNAME},
-                            {"NS", LDNS_RR_TYPE_NS},
-                            {"MX", LDNS_RR_TYPE_MX},
-                            {"TXT", LDNS_RR_TYPE_TXT},
-                            {"SOA", LDNS_RR_TYPE_SOA},
-                            {"CAA", LDNS_RR_TYPE_CAA},
-                            {"SRV", LDNS_RR_TYPE_SRV},
-                            {"DS", LDNS_RR_TYPE_DS},
-                            {"DNSKEY", LDNS_RR_TYPE_DNSKEY},
-                            {"PTR", LDNS_RR_TYPE_PTR},
-                        };
-                for (const auto &[type_name, type_code]: kTypeMap)
+            // Extract response details
+            int rcode = reply.rcode();
+            rcodes[g - first_try] = static_cast<signed char>(rcode);
+            const size_t an = reply.count(Section::Answer);
+            const size_t au = reply.count(Section::Authority);
+            const size_t ad = reply.count(Section::Additional);
+
+            // Minimum TTL: answers, or the authority section (negative
+            // caching) when there are none
+            int64_t min_ttl = -1;
+            if (reply.indexed)
+                reply.each_rr(an ? Section::Answer : Section::Authority,
+                              [&](const RrView &rr)
+                              {
+                                  auto ttl = static_cast<int64_t>(rr.ttl);
+                                  min_ttl  = min_ttl < 0
+                                                 ? ttl
+                                                 : std::min(min_ttl, ttl);
+                              });
+            ttls[g - first_try] = min_ttl;
+
+            transport[g - first_try] = {static_cast<uint32_t>(n),
+                                static_cast<uint32_t>(udp_size),
+                                truncated,
+                                fell_back,
+                                udp_ms,
+                                tcp_ms};
+
+            // Options echoed in the reply's OPT record: ECS scope prefix,
+            // NSID, and a server cookie bound to our client cookie
+            int         scope = -1;
+            std::string nsid;
+            const char *cookie_state = opt.cookie ? "none" : nullptr;
+            if (reply.indexed && (ecs || opt.nsid || opt.cookie))
+                reply.each_rr(Section::Additional, [&](const RrView &rr)
                 {
-                    if (opt.qtype == type_name)
+                    if (rr.type != 41) return;
+                    const auto &d = rr.rdata;
+                    for (size_t at = 0; at + 4 <= d.size();)
                     {
-                        qtype = type_code;
-                        break;
+                        uint16_t       code = get_u16(d, at);
+                        size_t         len  = get_u16(d, at + 2);
+                        const uint8_t *data = d.data() + at + 4;
+                        if (at + 4 + len > d.size()) break;
+                        at += 4 + len;
+                        switch (code)
+                        {
+                            case kEdnsClientSubnet:
+                                if (ecs && len >= 4) scope = data[3];
+                                break;
+                            case kEdnsNsid:
+                                if (opt.nsid) nsid = nsid_text(data, len);
+                                break;
+                            case kEdnsCookie:
+                                if (jar &&
+                                    len >= kClientCookieLen + kServerCookieMin &&
+                                    len <= kClientCookieLen + kServerCookieMax &&
+                                    std::memcmp(data,
+                                                jar->data(),
+                                                kClientCookieLen) == 0)
+                                {
+                                    if (!fell_back)
+                                        jar->assign(
+                                            reinterpret_cast<const char *>(data),
+                                            len);
+                                    cookie_state = cookie_sent ? "reused" : "new";
+                                }
+                                break;
+                            default:
+                                break;
+                        }
                     }
-                }
-                if (qtype == 0) qtype = LDNS_RR_TYPE_A;
-            }
-
-            ldns_pkt *pkt    = nullptr;
-            uint16_t  qflags = 0;
-            if (opt.rd) qflags |= LDNS_RD;
-            st = ldns_resolver_query_status(
-                &pkt,
-                res,
-                name,
-                qtype,
-                LDNS_RR_CLASS_IN,
-                qflags);
-            auto t1 = std::chrono::steady_clock::now();
-            ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
-            times[t - 1] = ms;
+                });
+            if (ecs) ecs_scope[g - first_try] = static_cast<int16_t>(scope);
+            if (opt.nsid) nsids[g - first_try] = nsid;
 
-            if (st != LDNS_STATUS_OK || !pkt)
+            if (opt.answer_sets)
             {
-                std::string err = "ldns query failed";
-                if (opt.ndjson)
-                {
-                    std::ostringstream os;
-                    os << std::fixed << std::setprecision(3);
-                    os << "{";
-                    os << "\"try\":" << t << ",\"ms\":" << ms << ",\"rc\":-1";
-                    os << R"(,"error":")" << json_escape(err) << R"(")";
-                    os << R"(,"raw_dns":{"type":")" << json_escape(opt.qtype) <<
-                            R"("}})";
-                    std::scoped_lock lk(g_print_mtx);
-                    std::print("{}\n", os.str());
-                }
-                else if (opt.json)
+                std::vector<std::string> addrs;
+                reply.each_rr(Section::Answer, [&](const RrView &rr)
                 {
-                    AttemptResult ar{};
-                    ar.ms           = ms;
-                    ar.rc           = -1;
-                    ar.error        = std::move(err);
-                    attempts[t - 1] = std::move(ar);
-                }
-                else
+                    if (rr.type == 1 && rr.rdata.size() == 4)
+                        addrs.push_back(addr_key(AF_INET, rr.rdata.data()));
+                    else if (rr.type == 28 && rr.rdata.size() == 16)
+                        addrs.push_back(addr_key(AF_INET6, rr.rdata.data()));
+                });
+                answer_sets[w].record(target, addrs);
+            }
+
+            if (opt.ndjson && !full)
+            {
+                if (line && !opt.capture_none)
                 {
+                    auto rec = std::format(R"({{"try":{},"ms":{:.3f},"rc":0{},"rcode":{}}})",
+                                           t,
+                                           ms,
+                                           host_field,
+                                           rcode);
                     std::scoped_lock lk(g_print_mtx);
-                    std::println(
-                        "try {}: {:.3f} ms - raw DNS error: ldns query failed",
-                        t,
-                        ms);
+                    std::print("{}\n", rec);
                 }
-                if (pkt) ldns_pkt_free(pkt);
-                ldns_rdf_deep_free(name);
-                ldns_resolver_deep_free(res);
-                return;
             }
-
-            // Extract response details
-            int  rcode = ldns_pkt_get_rcode(pkt);
-            bool f_aa  = ldns_pkt_aa(pkt);
-            bool f_tc  = ldns_pkt_tc(pkt);
-            bool f_rd  = ldns_pkt_rd(pkt);
-            bool f_ra  = ldns_pkt_ra(pkt);
-            bool f_ad  = ldns_pkt_ad(pkt);
-            bool f_cd  = ldns_pkt_cd(pkt);
-
-            ldns_rr_list *ans  = ldns_pkt_answer(pkt);
-            ldns_rr_list *auth = ldns_pkt_authority(pkt);
-            ldns_rr_list *addl = ldns_pkt_additional(pkt);
-            size_t        an   = ans ? ldns_rr_list_rr_count(ans) : 0;
-            size_t        au   = auth ? ldns_rr_list_rr_count(auth) : 0;
-            size_t        ad   = addl ? ldns_rr_list_rr_count(addl) : 0;
-
-            if (opt.ndjson)
+            else if (opt.ndjson)
             {
                 std::ostringstream os;
                 os << std::fixed << std::setprecision(3);
                 os << "{";
                 os << "\"try\":" << t << ",\"ms\":" << std::format("{:.3f}", ms)
-                        << ",\"rc\":0";
+                        << ",\"rc\":0" << host_field;
                 os << R"(,"raw_dns":{"type":")" << json_escape(opt.qtype) <<
-                        R"(","rcode":)" << rcode
-                        << R"(,"flags":{"aa":)" << (f_aa ? "true" : "false")
-                        << R"(,"tc":)" << (f_tc ? "true" : "false")
-                        << R"(,"rd":)" << (f_rd ? "true" : "false")
-                        << R"(,"ra":)" << (f_ra ? "true" : "false")
-                        << R"(,"ad":)" << (f_ad ? "true" : "false")
-                        << R"(,"cd":)" << (f_cd ? "true" : "false") << "}"
+                        R"(","rcode":)" << rcode;
+                if (min_ttl >= 0) os << R"(,"min_ttl":)" << min_ttl;
+                if (scope >= 0) os << R"(,"ecs_scope":)" << scope;
+                if (!nsid.empty())
+                    os << R"(,"nsid":")" << json_escape(nsid) << "\"";
+                if (cookie_state)
+                    os << R"(,"cookie":")" << cookie_state << "\"";
+                os << R"(,"size":)" << n << R"(,"truncated":)"
+                        << (truncated ? "true" : "false") << R"(,"fallback":)"
+                        << (fell_back ? "true" : "false");
+                if (fell_back)
+                    os << R"(,"legs":{"udp_ms":)" << udp_ms << R"(,"udp_size":)"
+                            << udp_size << R"(,"tcp_ms":)" << tcp_ms << "}";
+                os << R"(,"flags":{"aa":)" << (reply.flag(kFlagAa) ? "true" : "false")
+                        << R"(,"tc":)" << (reply.flag(kFlagTc) ? "true" : "false")
+                        << R"(,"rd":)" << (reply.flag(kFlagRd) ? "true" : "false")
+                        << R"(,"ra":)" << (reply.flag(kFlagRa) ? "true" : "false")
+                        << R"(,"ad":)" << (reply.flag(kFlagAd) ? "true" : "false")
+                        << R"(,"cd":)" << (reply.flag(kFlagCd) ? "true" : "false") << "}}"
                         << R"(,"counts":{"answer":)" << an << R"(,"authority":)"
                         << au << R"(,"additional":)" << ad << "}";
-                // answers array as rr strings
+                // answers array as rr strings, decoded straight from the
+                // receive buffer
                 os << ",\"answers\":[";
-                for (size_t i = 0; i < an; ++i)
+                bool first = true;
+                reply.each_rr(Section::Answer, [&](const RrView &rr)
                 {
-                    if (i) os << ",";
-                    ldns_rr *rr = ldns_rr_list_rr(ans, i);
-                    if (char *s = ldns_rr2str(rr))
-                    {
-                        os << R"(")" << json_escape(std::string{s}).c_str() <<
-                                R"(")";
-                        LDNS_FREE(s);
-                    }
-                    else { os << R"(")" << "" << R"(")"; }
-                }
-                os << "]}"; // close raw_dns and object
+                    os << (first ? "\"" : ",\"")
+                            << json_escape(rr_text(reply.msg, rr)) << "\"";
+                    first = false;
+                });
+                os << ']';
+                if (capture)
+                    put_capture_json(os,
+                                     o,
+                                     std::chrono::duration<double, std::milli>(
+                                         o.t0 - run_t0).count(),
+                                     &reply);
+                os << '}';
                 std::scoped_lock lk(g_print_mtx);
                 std::print("{}\n", os.str());
             }
@@ -1214,72 +7169,38 @@ int main(int argc, char **argv)
                 ar.ms = ms;
                 ar.rc = 0;
                 ar.error.clear();
-                attempts[t - 1] = std::move(ar);
+                attempts[g - first_try] = std::move(ar);
             }
-            else
+            else if (!quiet)
             {
+                std::string extra;
+                if (opt.nsid) extra += " nsid=" + (nsid.empty() ? "-" : nsid);
+                if (cookie_state) extra += std::string(" cookie=") + cookie_state;
+                extra += std::format(" size={}", n);
+                if (fell_back)
+                    extra += std::format(
+                        " tc->tcp (udp {:.3f} ms, {} bytes; tcp {:.3f} ms)",
+                        udp_ms,
+                        udp_size,
+                        tcp_ms);
                 std::scoped_lock lk(g_print_mtx);
                 std::println(
-                    "try {}: {:.3f} ms - raw DNS rcode={} aa={} tc={} rd={} ra={} ad={} cd={} an={}",
+                    "{}try {}: {:.3f} ms - raw DNS rcode={} aa={} tc={} rd={} ra={} ad={} cd={} an={} ttl={}{}",
+                    tag,
                     t,
                     ms,
                     rcode,
-                    f_aa,
-                    f_tc,
-                    f_rd,
-                    f_ra,
-                    f_ad,
-                    f_cd,
-                    an);
-            }
-
-            if (pkt) ldns_pkt_free(pkt);
-            ldns_rdf_deep_free(name);
-            ldns_resolver_deep_free(res);
-            return;
-#else
-            auto t1 = std::chrono::steady_clock::now();
-            ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
-            times[t - 1] = ms;
-            std::string err =
-                    "ldns not available: rebuild with ldns (pkg-config ldns) to enable raw DNS";
-            if (opt.ndjson)
-            {
-                std::ostringstream os;
-                os << std::fixed << std::setprecision(3);
-                os << "{";
-                os << "\"try\":" << t << ",\"ms\":" << std::format("{:.3f}", ms)
-                        << ",\"rc\":-1";
-                os << R"(,"error":")" << json_escape(err) << R"(")";
-                os << R"(,"raw_dns":{"type":")" << json_escape(opt.qtype) <<
-                        R"(","ns":")" << json_escape(opt.ns)
-                        << R"(","rd":)" << (opt.rd ? "true" : "false") <<
-                        R"(,"do":)" << (opt.do_bit ? "true" : "false")
-                        << R"(,"timeout_ms":)" << opt.timeout_ms << R"(,"tcp":)"
-                        << (opt.tcp ? "true" : "false") << "}";
-                os << "}";
-                std::scoped_lock lk(g_print_mtx);
-                std::print("{}\n", os.str());
-            }
-            else if (opt.json)
-            {
-                AttemptResult ar{};
-                ar.ms           = ms;
-                ar.rc           = -1;
-                ar.error        = std::move(err);
-                attempts[t - 1] = std::move(ar);
-            }
-            else
-            {
-                std::scoped_lock lk(g_print_mtx);
-                std::println(
-                    "try {}: {:.3f} ms - raw DNS error: {}",
-                    t,
-                    ms,
-                    err);
+                    reply.flag(kFlagAa),
+                    reply.flag(kFlagTc),
+                    reply.flag(kFlagRd),
+                    reply.flag(kFlagRa),
+                    reply.flag(kFlagAd),
+                    reply.flag(kFlagCd),
+                    an,
+                    min_ttl,
+                    extra);
             }
             return;
-#endif
         }
 
         addrinfo hints{};
@@ -1298,25 +7219,29 @@ int main(int argc, char **argv)
         const char *service = opt.service.empty()
                                   ? nullptr
                                   : opt.service.c_str();
-        int    rc = getaddrinfo(opt.host.c_str(), service, &hints, &res);
+        int    rc = getaddrinfo(host.c_str(), service, &hints, &res);
         auto   t1 = std::chrono::steady_clock::now();
         double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
-        times[t - 1] = ms;
+        times[g - first_try] = ms;
 
         if (rc != 0)
-        {
-            if (opt.ndjson)
-            {
-                std::ostringstream os;
-                os << std::fixed << std::setprecision(3);
-                os << "{";
-                os << "\"try\":" << t << ",\"ms\":" << std::format("{:.3f}", ms)
-                        << ",\"rc\":"
-                        << rc;
-                os << R"(,"error":")" << json_escape(gai_strerror(rc)) << "\"";
-                os << "}";
-                std::scoped_lock lk(g_print_mtx);
-                std::print("{}\n", os.str());
+        {
+            failed[g - first_try] = 1;
+            if (opt.ndjson)
+            {
+                if (line)
+                {
+                    std::ostringstream os;
+                    os << std::fixed << std::setprecision(3);
+                    os << "{";
+                    os << "\"try\":" << t << ",\"ms\":" << std::format("{:.3f}", ms)
+                            << ",\"rc\":"
+                            << rc << host_field;
+                    os << R"(,"error":")" << json_escape(gai_strerror(rc)) << "\"";
+                    os << "}";
+                    std::scoped_lock lk(g_print_mtx);
+                    std::print("{}\n", os.str());
+                }
             }
             else if (opt.json)
             {
@@ -1324,13 +7249,14 @@ int main(int argc, char **argv)
                 ar.ms           = ms;
                 ar.rc           = rc;
                 ar.error        = gai_strerror(rc);
-                attempts[t - 1] = std::move(ar);
+                attempts[g - first_try] = std::move(ar);
             }
-            else
+            else if (!quiet)
             {
                 std::scoped_lock lk(g_print_mtx);
                 std::println(
-                    "try {}: {:.3f} ms - error: {}",
+                    "{}try {}: {:.3f} ms - error: {}",
+                    tag,
                     t,
                     ms,
                     gai_strerror(rc));
@@ -1349,53 +7275,74 @@ int main(int argc, char **argv)
         std::string canon = res && res->ai_canonname
                                 ? std::string(res->ai_canonname)
                                 : std::string();
+        if (opt.answer_sets)
+        {
+            std::vector<std::string> addrs;
+            for (const addrinfo *ai = res; ai != nullptr; ai = ai->ai_next)
+            {
+                if (ai->ai_family == AF_INET)
+                    addrs.push_back(addr_key(
+                        AF_INET,
+                        &reinterpret_cast<const sockaddr_in *>(ai->ai_addr)->
+                        sin_addr));
+                else if (ai->ai_family == AF_INET6)
+                    addrs.push_back(addr_key(
+                        AF_INET6,
+                        &reinterpret_cast<const sockaddr_in6 *>(ai->ai_addr)->
+                        sin6_addr));
+            }
+            answer_sets[w].record(target, addrs);
+        }
 
         if (opt.ndjson)
         {
-            std::ostringstream os;
-            os << std::fixed << std::setprecision(3);
-            os << "{";
-            os << "\"try\":" << t << ",\"ms\":" << std::format("{:.3f}", ms) <<
-                    ",\"rc\":0";
-            if (!canon.empty())
-                os << R"(,"canon":")" << json_escape(canon) <<
-                        "\"";
-            os << ",\"addresses\":[";
-            for (size_t j = 0; j < entries.size(); ++j)
-            {
-                const auto &[e_af, e_socktype, e_protocol, e_port, e_ip] =
-                        entries[j];
-                if (j) os << ",";
-                os << R"({"family":")" << json_escape(family_str(e_af))
-                        << R"(","ip":")" << json_escape(e_ip)
-                        << R"(","socktype":")" << json_escape(
-                            socktype_str(e_socktype))
-                        << R"(","protocol":")" << json_escape(
-                            proto_str(e_protocol))
-                        << R"(","port":)" << e_port << "}";
-            }
-            os << "]";
-            if (!ptrs.empty())
+            if (line)
             {
-                os << ",\"ptr\":[";
-                for (size_t k = 0; k < ptrs.size(); ++k)
+                std::ostringstream os;
+                os << std::fixed << std::setprecision(3);
+                os << "{";
+                os << "\"try\":" << t << ",\"ms\":" << std::format("{:.3f}", ms) <<
+                        ",\"rc\":0" << host_field;
+                if (!canon.empty())
+                    os << R"(,"canon":")" << json_escape(canon) <<
+                            "\"";
+                os << ",\"addresses\":[";
+                for (size_t j = 0; j < entries.size(); ++j)
                 {
-                    const auto &[p_af, p_ip, p_rc, p_name, p_error] = ptrs[k];
-                    if (k) os << ",";
-                    os << R"({"family":")" << json_escape(family_str(p_af))
-                            << R"(","ip":")" << json_escape(p_ip)
-                            << R"(","rc":)" << p_rc;
-                    if (p_rc == 0)
-                        os << R"(,"name":")" << json_escape(p_name)
-                                << "\"";
-                    else os << R"(,"error":")" << json_escape(p_error) << "\"";
-                    os << "}";
+                    const auto &[e_af, e_socktype, e_protocol, e_port, e_ip] =
+                            entries[j];
+                    if (j) os << ",";
+                    os << R"({"family":")" << json_escape(family_str(e_af))
+                            << R"(","ip":")" << json_escape(e_ip)
+                            << R"(","socktype":")" << json_escape(
+                                socktype_str(e_socktype))
+                            << R"(","protocol":")" << json_escape(
+                                proto_str(e_protocol))
+                            << R"(","port":)" << e_port << "}";
                 }
                 os << "]";
+                if (!ptrs.empty())
+                {
+                    os << ",\"ptr\":[";
+                    for (size_t k = 0; k < ptrs.size(); ++k)
+                    {
+                        const auto &[p_af, p_ip, p_rc, p_name, p_error] = ptrs[k];
+                        if (k) os << ",";
+                        os << R"({"family":")" << json_escape(family_str(p_af))
+                                << R"(","ip":")" << json_escape(p_ip)
+                                << R"(","rc":)" << p_rc;
+                        if (p_rc == 0)
+                            os << R"(,"name":")" << json_escape(p_name)
+                                    << "\"";
+                        else os << R"(,"error":")" << json_escape(p_error) << "\"";
+                        os << "}";
+                    }
+                    os << "]";
+                }
+                os << "}";
+                std::scoped_lock lk(g_print_mtx);
+                std::print("{}\n", os.str());
             }
-            os << "}";
-            std::scoped_lock lk(g_print_mtx);
-            std::print("{}\n", os.str());
         }
         else if (opt.json)
         {
@@ -1405,15 +7352,16 @@ int main(int argc, char **argv)
             ar.canon        = std::move(canon);
             ar.entries      = std::move(entries);
             ar.ptrs         = std::move(ptrs);
-            attempts[t - 1] = std::move(ar);
+            attempts[g - first_try] = std::move(ar);
         }
-        else
+        else if (!quiet)
         {
             std::scoped_lock lk(g_print_mtx);
             print_entries(entries);
             print_ptrs(ptrs);
             std::println(
-                "try {}: {:.3f} ms - {} address(es)",
+                "{}try {}: {:.3f} ms - {} address(es)",
+                tag,
                 t,
                 ms,
                 entries.size());
@@ -1422,39 +7370,561 @@ int main(int argc, char **argv)
         if (res) freeaddrinfo(res);
     };
 
-    if (opt.concurrency <= 1)
+    // Worker pool: each worker pulls the next try number
+    std::atomic<int>        next_try{first_try};
+    auto                    record_attempt = [&](int g, int w)
     {
-        for (int t = 1; t <= opt.tries; ++t) attempt_fn(t);
-    }
-    else
+        if (phase[g - first_try] != Phase::Measured) return;
+        shards[w].record(times[g - first_try], failed[g - first_try], rcodes[g - first_try]);
+        if (multi_host)
+            host_stats.record((g - 1) % n_hosts, times[g - first_try], failed[g - first_try]);
+        if (!opt.ecs.empty())
+            subnet_stats.record((g - 1) % n_targets / n_hosts,
+                                times[g - first_try],
+                                failed[g - first_try]);
+        if (!sources.empty())
+            source_stats.record(attempt_src[g - first_try], times[g - first_try], failed[g - first_try]);
+    };
+
+    // Raw UDP event loop: keep up to window_of(w) attempts of worker w in
+    // flight over its own socket pool (its own source ports, so replies
+    // spread over receive queues and cores by flow hash), match replies by
+    // (socket, ID) and question, and expire attempts from the worker's timer
+    // wheel, cancelling the timer when the reply comes first. Sockets, IDs,
+    // timers and stats shards are the worker's own; what a finished attempt
+    // reports still meets the other workers' there: per-try output takes the
+    // print lock, and the per-host, per-subnet and per-source tables take
+    // striped locks. A truncated reply is retried over TCP right here, which
+    // stalls this worker's other attempts for that long.
+    auto raw_loop = [&](int w)
+    {
+        using Clock        = std::chrono::steady_clock;
+        StatsShard &  shard = shards[w];
+        QueryScratch &qs    = scratch[w];
+        UdpSocketPool pool{server,
+                           server_len,
+                           std::chrono::milliseconds(
+                               std::max(2 * opt.timeout_ms, 1000)),
+                           qs.rng,
+                           {}};
+        pool.busy_poll_us = opt.busy_poll;
+        pool.cookies      = opt.cookie;
+        // This worker's share of the bound sources
+        for (size_t i = static_cast<size_t>(w); i < source_fds.size();
+             i += static_cast<size_t>(workers))
+            pool.adopt(source_fds[i], static_cast<uint32_t>(i));
+        pool.fixed = !source_fds.empty();
+        size_t next_source = 0; // --source-order rr
+        std::vector<RawInflight> slots(static_cast<size_t>(window_of(w)));
+        std::vector<uint32_t>    free_slots(slots.size());
+        std::iota(free_slots.rbegin(), free_slots.rend(), 0u);
+        TimerWheel               timers;
+        std::vector<pollfd> pfds;
+        size_t              inflight = 0;
+        size_t              spinning = 0; // in-flight --busy-poll tries
+        uint64_t            unsent   = 0;
+        if (opt.pin && !pin_to_cpu(proc * workers + w))
+        {
+            std::scoped_lock lk(g_print_mtx);
+            std::println(stderr, "cannot pin raw worker {} to a CPU", w);
+        }
+
+        auto finish = [&](uint32_t slot, RawOutcome &o)
+        {
+            RawInflight &f = slots[slot];
+            const int    g = f.g;
+            o.t0           = f.t0;
+            o.wire         = &f.wire;
+            o.cookie_sent  = f.cookie_sent;
+            o.mismatched   = f.mismatched;
+            attempt_fn(g, w, &o);
+            record_attempt(g, w);
+            if (f.spin) --spinning;
+            f.g    = 0;
+            f.spin = false;
+            free_slots.push_back(slot);
+            StatsShard::set(shard.inflight, --inflight);
+        };
+
+        auto start = [&](int g)
+        {
+            const uint32_t slot = free_slots.back();
+            free_slots.pop_back();
+            StatsShard::set(shard.inflight, ++inflight);
+            RawInflight &        f   = slots[slot];
+            const QueryTemplate &tpl = templates[(g - 1) % n_targets];
+            f.g          = g;
+            f.mismatched = false;
+            // --busy-poll alternates the two wait modes in blocks of tries
+            f.spin = opt.busy_poll >= 0 &&
+                     busy_poll_spins(g, n_targets, opt.concurrency);
+            if (f.spin) ++spinning;
+            f.t0 = Clock::now();
+            if (pool.fixed)
+            {
+                // Sources are taken in turn, or by a hash of the target so a
+                // name keeps leaving from the same one; a source out of IDs
+                // passes the query on to the next
+                uint64_t key = static_cast<uint64_t>((g - 1) % n_targets);
+                pool.cur = (opt.source_hash ? next_random(key) : next_source++) %
+                           pool.socks.size();
+                attempt_src[g - first_try] = pool.socks[pool.cur]->src;
+            }
+            RawOutcome o;
+            if (!server_ok) o.err = "invalid nameserver";
+            else if (tpl.wire.empty()) o.err = "invalid qname";
+            else if (pool.lease(slot, f.t0, f.sock, f.id, o.err))
+            {
+                if (pool.fixed) attempt_src[g - first_try] = pool.socks[f.sock]->src;
+                const std::string &cookie = pool.socks[f.sock]->cookie;
+                f.cookie_sent = cookie.size() > kClientCookieLen;
+                patch_query(tpl, opt, cookie, f.id, qs.rng, f.wire);
+                if (send(pool.socks[f.sock]->fd, f.wire.data(), f.wire.size(), 0) >= 0)
+                {
+                    if (opt.timeout_ms)
+                        f.timer = timers.schedule(
+                            f.t0 + std::chrono::milliseconds(opt.timeout_ms),
+                            slot);
+                    return;
+                }
+                o.err = std::format("udp send: {}", std::strerror(errno));
+                pool.release(f.sock, f.id);
+            }
+            ++unsent;
+            finish(slot, o);
+        };
+
+        auto on_reply = [&](uint32_t                 sock,
+                            std::span<const uint8_t> msg,
+                            Clock::time_point        rx_at)
+        {
+            uint32_t slot = msg.size() >= 12
+                                ? pool.socks[sock]->owner(get_u16(msg, 0))
+                                : kNoSlot;
+            if (slot == kNoSlot)
+            {
+                ++pool.stray; // late reply to a timed-out query, or junk
+                return;
+            }
+            RawInflight &f = slots[slot];
+            if (!ReplyView{msg}.check(wire_bytes(f.wire),
+                                      templates[(f.g - 1) % n_targets].qname_len,
+                                      opt.case_0x20))
+            {
+                f.mismatched = true;
+                ++pool.stray;
+                return;
+            }
+            pool.release(sock, f.id);
+            timers.cancel(f.timer);
+            RawOutcome o;
+            o.reply  = msg;
+            o.rx_at  = rx_at;
+            o.cookie = opt.cookie ? &pool.socks[sock]->cookie : nullptr;
+            if (ReplyView{msg}.flag(kFlagTc))
+            {
+                auto tl     = Clock::now();
+                o.truncated = o.fell_back = true;
+                o.udp_size  = msg.size();
+                o.udp_ms    = std::chrono::duration<double, std::milli>(
+                    rx_at - f.t0).count();
+                ssize_t n = tcp_exchange(server,
+                                         server_len,
+                                         wire_bytes(f.wire),
+                                         qs.rx,
+                                         opt.timeout_ms,
+                                         o.err);
+                o.reply = std::span<const uint8_t>(qs.rx).first(
+                    n > 0 ? static_cast<size_t>(n) : 0);
+                o.rx_at  = Clock::now();
+                o.tcp_ms = std::chrono::duration<double, std::milli>(
+                    o.rx_at - tl).count();
+            }
+            finish(slot, o);
+        };
+
+        // A socket error (e.g. ICMP port unreachable) cannot be tied to one
+        // query, so it fails every attempt in flight on that socket
+        auto fail_socket = [&](uint32_t sock, int error)
+        {
+            for (uint32_t slot = 0; slot < slots.size(); ++slot)
+            {
+                if (!slots[slot].g || slots[slot].sock != sock) continue;
+                pool.release(sock, slots[slot].id);
+                timers.cancel(slots[slot].timer);
+                RawOutcome o;
+                o.err = std::format("udp recv: {}", std::strerror(error));
+                finish(slot, o);
+            }
+        };
+
+        // Tries are claimed in batches so the shared counter is touched
+        // once per batch rather than once per query
+        const int batch = std::clamp(
+            (last_try - first_try + 1) / (workers * 256), 1, 64);
+
+        // Start tries while fewer than limit are in flight until none are
+        // left, the run is stopped or the time is up; then drain. gap paces
+        // the starts of a --sweep rate step (zero: as fast as replies come).
+        auto run = [&](size_t                           limit,
+                       std::optional<Clock::time_point> until,
+                       Clock::duration                  gap)
+        {
+            int  claim = 1, claim_end = 1; // claimed, not yet started
+            bool more  = limit > 0;
+            // Paced workers start a fraction of a gap apart
+            auto next_start = Clock::now() + gap * w / workers;
+            while (more || inflight)
+            {
+                if (until && Clock::now() >= *until) more = false;
+                while (more && inflight < limit)
+                {
+                    if (stop_run.load(std::memory_order_relaxed))
+                    {
+                        more = false;
+                        break;
+                    }
+                    if (gap.count() && Clock::now() < next_start) break;
+                    if (claim == claim_end)
+                    {
+                        claim = next_try.fetch_add(batch, std::memory_order_relaxed);
+                        claim_end = std::min(claim + batch, last_try + 1);
+                        if (claim > last_try)
+                        {
+                            more = false;
+                            break;
+                        }
+                    }
+                    // --busy-poll: drain before switching wait modes
+                    if (opt.busy_poll >= 0 && inflight &&
+                        (spinning > 0) !=
+                            busy_poll_spins(claim, n_targets, opt.concurrency))
+                        break;
+                    start(claim++);
+                    next_start += gap;
+                }
+                if (!inflight)
+                {
+                    // Only a paced step waits here for its next start
+                    if (more)
+                        std::this_thread::sleep_until(
+                            until ? std::min(next_start, *until) : next_start);
+                    continue;
+                }
+
+                // While --busy-poll tries are in flight (then all of them are),
+                // spin on non-blocking receives instead of sleeping in poll, so
+                // no wakeup latency is added to their RTT
+                const bool spin = spinning > 0;
+                pfds.clear();
+                for (const auto &sock: pool.socks)
+                    pfds.push_back({sock->fd, POLLIN, 0});
+                auto wake = timers.next_expiry();
+                if (more && gap.count() && inflight < limit &&
+                    (!wake || next_start < *wake))
+                    wake = next_start;
+                if (spin || poll_until(pfds, wake) > 0)
+                {
+                    for (uint32_t i = 0; i < pfds.size(); ++i)
+                    {
+                        if (!spin && !pfds[i].revents) continue;
+                        while (true)
+                        {
+                            ssize_t n = recv(pfds[i].fd, qs.rx.data(), qs.rx.size(), 0);
+                            if (n >= 0)
+                            {
+                                // Stamped here: replies drained in the same
+                                // pass must not pay for each other's output
+                                on_reply(i,
+                                         std::span<const uint8_t>(qs.rx).first(
+                                             static_cast<size_t>(n)),
+                                         Clock::now());
+                                continue;
+                            }
+                            if (errno == EINTR) continue;
+                            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                fail_socket(i, errno);
+                            break;
+                        }
+                    }
+                }
+
+                const auto now = Clock::now();
+                timers.advance(now, [&](uint32_t slot)
+                {
+                    pool.retire(slots[slot].sock, slots[slot].id, now);
+                    RawOutcome o;
+                    o.rx_at = now;
+                    finish(slot, o);
+                });
+            }
+        };
+
+        if (opt.sweep.empty()) run(slots.size(), std::nullopt, {});
+        // --sweep: the same pool and sockets for every step. The coordinator
+        // resets the shards and sets sweep_t0 before the first barrier, and
+        // collects the step after the second, once every worker has drained.
+        for (int v: opt.sweep)
+        {
+            sweep_sync.arrive_and_wait();
+            const auto until = sweep_t0 + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(opt.sweep_step_ms));
+            if (opt.sweep_rate)
+                run(slots.size(),
+                    until,
+                    std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(workers / static_cast<double>(v))));
+            else
+                run(static_cast<size_t>(v * (w + 1) / workers - v * w / workers),
+                    until,
+                    {});
+            sweep_sync.arrive_and_wait();
+        }
+        if (!pool.busy_poll_err.empty() && !busy_poll_warned.exchange(true))
+        {
+            std::scoped_lock lk(g_print_mtx);
+            std::println(stderr,
+                         "SO_BUSY_POLL not set: {}",
+                         pool.busy_poll_err);
+        }
+        raw_stray.fetch_add(pool.stray, std::memory_order_relaxed);
+        raw_unsent.fetch_add(unsent, std::memory_order_relaxed);
+        raw_sockets.fetch_add(pool.socks.size(), std::memory_order_relaxed);
+    };
+
+    auto worker_fn = [&](int w)
+    {
+        if (raw_async)
+        {
+            raw_loop(w);
+            return;
+        }
+        StatsShard &shard = shards[w];
+        for (int g = next_try.fetch_add(1, std::memory_order_relaxed);
+             g <= last_try && !stop_run.load(std::memory_order_relaxed);
+             g = next_try.fetch_add(1, std::memory_order_relaxed))
+        {
+            StatsShard::set(shard.inflight, 1);
+            attempt_fn(g, w);
+            StatsShard::set(shard.inflight, 0);
+            record_attempt(g, w);
+        }
+    };
+
+    std::mutex              live_mtx;
+    std::condition_variable live_cv;
+    bool                    live_stop = false;
+    std::thread             live_thread;
+    if (opt.live)
+        live_thread = std::thread([&]
+        {
+            run_live_view(opt, total, shards, live_mtx, live_cv, live_stop);
+        });
+
+    // --until-stable: check the merged shards a few times a second; one
+    // narrow reading can be luck in the tail, so three in a row are needed
+    std::mutex              stable_mtx;
+    std::condition_variable stable_cv;
+    bool                    stable_stop = false;
+    std::thread             stable_thread;
+    if (opt.stable_pctl)
+        stable_thread = std::thread([&]
+        {
+            std::unique_lock lk(stable_mtx);
+            int              streak = 0;
+            while (!stable_cv.wait_for(lk,
+                                       std::chrono::milliseconds(250),
+                                       [&] { return stable_stop; }))
+            {
+                LatencyHistogram hist;
+                for (const auto &shard: shards) shard.snapshot(hist);
+                auto ci = quantile_ci(hist, opt.stable_pctl);
+                streak  = ci.ok && ci.width_pct() <= opt.stable_width
+                              ? streak + 1
+                              : 0;
+                if (streak == 3)
+                {
+                    stop_run.store(true);
+                    break;
+                }
+            }
+        });
+
+    // --sweep: this thread steps the workers through the sweep and reports
+    // each step as soon as it has drained
+    const std::vector<int> sweep_pctl = opt.pctl.empty()
+                                            ? std::vector<int>{50, 99}
+                                            : opt.pctl;
+    std::vector<SweepStep> sweep_steps;
+    auto                   run_sweep = [&]
     {
-        int next = 1;
-        while (next <= opt.tries)
+        using Clock = std::chrono::steady_clock;
+        if (!sweep_json && !sweep_ndjson) print_sweep_header(opt, sweep_pctl);
+        for (size_t k = 0; k < opt.sweep.size(); ++k)
         {
-            int batch = std::min(opt.concurrency, opt.tries - (next - 1));
-            std::vector<std::thread> threads;
-            threads.reserve(batch);
-            for (int i = 0; i < batch; ++i)
+            for (auto &shard: shards) shard.reset();
+            next_try.store(first_try);
+            sweep_t0 = Clock::now();
+            sweep_sync.arrive_and_wait();
+            // qps counts what completes within the step's time; if --tries
+            // runs out first, the step lasts until its last attempt is done
+            const auto until = sweep_t0 + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(opt.sweep_step_ms));
+            SweepStep st;
+            st.value = opt.sweep[k];
+            for (auto now = Clock::now();
+                 now < until && next_try.load(std::memory_order_relaxed) <= last_try;
+                 now = Clock::now())
+                std::this_thread::sleep_for(std::min<Clock::duration>(
+                    until - now, std::chrono::milliseconds(10)));
+            auto elapsed = [&]
+            {
+                return std::chrono::duration<double>(Clock::now() - sweep_t0)
+                .count();
+            };
+            st.capped = next_try.load() > last_try;
+            st.secs   = elapsed();
+            for (const auto &shard: shards) st.done += StatsShard::get(shard.done);
+            sweep_sync.arrive_and_wait();
+            for (const auto &shard: shards) shard.snapshot(st.hist);
+            if (st.capped)
+            {
+                st.secs = elapsed();
+                st.done = st.hist.total;
+            }
+            if (sweep_ndjson)
             {
-                int attempt = next + i;
-                threads.emplace_back([&, attempt] { attempt_fn(attempt); });
+                std::ostringstream os;
+                os << std::fixed << std::setprecision(3);
+                os << "{\"step\":" << k + 1 << ',';
+                print_sweep_json(st, opt, sweep_pctl, os);
+                os << '}';
+                std::println("{}", os.str());
             }
-            for (auto &th: threads)
+            else if (!sweep_json) print_sweep_row(st, sweep_pctl);
+            std::fflush(stdout);
+            sweep_steps.push_back(std::move(st));
+        }
+    };
+
+    if (workers <= 1 && opt.sweep.empty())
+    {
+        worker_fn(0);
+    }
+    else
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(workers);
+        for (int w = 0; w < workers; ++w)
+            threads.emplace_back([&, w] { worker_fn(w); });
+        if (!opt.sweep.empty()) run_sweep();
+        for (auto &th: threads) th.join();
+    }
+    for (size_t w = 1; w < answer_sets.size(); ++w)
+        answer_sets[0].merge(answer_sets[w]);
+
+    if (live_thread.joinable())
+    {
+        {
+            std::scoped_lock lk(live_mtx);
+            live_stop = true;
+        }
+        live_cv.notify_one();
+        live_thread.join();
+    }
+    if (stable_thread.joinable())
+    {
+        {
+            std::scoped_lock lk(stable_mtx);
+            stable_stop = true;
+        }
+        stable_cv.notify_one();
+        stable_thread.join();
+    }
+    if (shared)
+    {
+        // A --procs child is done once its shards are complete; the parent
+        // writes the histogram and the summary, and counts a child that could
+        // not set up or send its queries as failed
+        StatsShard::set(shared->counters[proc].udp_sockets, raw_sockets.load());
+        StatsShard::set(shared->counters[proc].stray, raw_stray.load());
+        const bool setup_failed =
+                raw_mode &&
+                (!server_ok || raw_unsent.load() ||
+                 std::ranges::any_of(templates,
+                                     [](const QueryTemplate &t)
+                                     {
+                                         return t.wire.empty();
+                                     }));
+        std::fflush(stdout);
+        _exit(setup_failed ? 1 : 0);
+    }
+
+    if (!opt.sweep.empty())
+    {
+        if (sweep_json)
+        {
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(3);
+            os << R"({"sweep":{"param":")" <<
+                    (opt.sweep_rate ? "rate" : "concurrency") <<
+                    R"(","step_s":)" << opt.sweep_step_ms / 1000 << ",\"workers\":" <<
+                    workers << ",\"steps\":[";
+            for (size_t k = 0; k < sweep_steps.size(); ++k)
             {
-                if (th.joinable()) th.join();
+                os << (k ? ",{" : "{");
+                print_sweep_json(sweep_steps[k], opt, sweep_pctl, os);
+                os << '}';
             }
-            next += batch;
+            os << "]}}";
+            std::println("{}", os.str());
+        }
+        return 0;
+    }
+
+    if (!opt.hist_out.empty())
+    {
+        LatencyHistogram hist;
+        for (const auto &shard: shards) shard.snapshot(hist);
+        if (!hist_write_file(opt.hist_out, hist, opt.compress_level))
+        {
+            std::println(stderr, "cannot write histogram: {}", opt.hist_out);
+            return 1;
         }
     }
 
     if (!times.empty())
     {
-        auto [min_it, max_it] = std::minmax_element(times.begin(), times.end());
-        double minv = *min_it, maxv = *max_it;
-        double avg = std::accumulate(times.begin(), times.end(), 0.0) /
-                     static_cast<double>(times.size());
+        // The summaries cover measured attempts only: not --warmup ones, nor
+        // those --until-stable never started
+        const bool partial = opt.warmup_n || opt.warmup_ms > 0 || opt.stable_pctl;
+        auto       counts  = [&](size_t i) { return phase[i] == Phase::Measured; };
+        std::vector<double> measured;
+        LatencyHistogram    warmup_hist;
+        for (size_t i = 0; partial && i < times.size(); ++i)
+        {
+            if (counts(i)) measured.push_back(times[i]);
+            else if (phase[i] == Phase::Warmup)
+                warmup_hist.record(times[i], failed[i]);
+        }
+        const std::vector<double> &mt = partial ? measured : times;
+        double minv = 0, maxv = 0, avg = 0;
+        if (!mt.empty())
+        {
+            auto [min_it, max_it] = std::minmax_element(mt.begin(), mt.end());
+            minv = *min_it;
+            maxv = *max_it;
+            avg  = std::accumulate(mt.begin(), mt.end(), 0.0) /
+                   static_cast<double>(mt.size());
+        }
+        // --until-stable and --ci work from a histogram of the same samples
+        LatencyHistogram mt_hist;
+        if (opt.stable_pctl || opt.ci_level)
+            for (double v: mt) mt_hist.record(v, false);
+        std::optional<QuantileCi> stability;
+        if (opt.stable_pctl) stability = quantile_ci(mt_hist, opt.stable_pctl);
         // Precompute percentiles if requested
-        std::vector<double> sorted = times;
+        std::vector<double> sorted = mt;
         std::ranges::sort(sorted);
         auto pct_value = [&](int p) -> double
         {
@@ -1467,6 +7937,80 @@ int main(int argc, char **argv)
             if (rank > n) rank = n;
             return sorted[rank - 1];
         };
+        // The bootstrap runs at bucket resolution; each interval is shifted
+        // onto the exact value reported from the raw samples
+        std::optional<BootstrapCi> ci;
+        if (opt.ci_level && !mt.empty())
+        {
+            ci = bootstrap_ci(mt_hist, opt.pctl, opt.ci_level);
+            for (size_t k = 0; k < opt.pctl.size(); ++k)
+            {
+                double shift = pct_value(opt.pctl[k]) - mt_hist.pct_ms(opt.pctl[k]);
+                ci->pctl[k].first += shift;
+                ci->pctl[k].second += shift;
+            }
+        }
+        // Answer sets are keyed by target; label them "host", "ecs=subnet"
+        // or "host ecs=subnet" as the run requires
+        std::vector<std::string> targets = opt.hosts;
+        if (!opt.ecs.empty())
+        {
+            targets.clear();
+            for (int k = 0; k < n_targets; ++k)
+                targets.push_back(
+                    (multi_host ? opt.hosts[k % n_hosts] + " " : "") + "ecs=" +
+                    opt.ecs[k / n_hosts].text);
+        }
+        // Widest scope prefix the server returned per subnet (-1 if none)
+        std::vector<int> subnet_scope(opt.ecs.size(), -1);
+        for (size_t i = 0; i < ecs_scope.size(); ++i)
+        {
+            int &sc = subnet_scope[i % n_targets / n_hosts];
+            sc      = std::max(sc, static_cast<int>(ecs_scope[i]));
+        }
+        // Latency per answering anycast instance, keyed by NSID
+        std::map<std::string, HostStats> instances;
+        for (size_t i = 0; i < nsids.size(); ++i)
+            if (counts(i))
+                instances[nsids[i].empty() ? "(none)" : nsids[i]].record(
+                    times[i],
+                    failed[i]);
+        std::optional<TransportSummary> xport;
+        if (raw_mode)
+        {
+            if (partial)
+            {
+                std::vector<TransportRecord> kept;
+                for (size_t i = 0; i < transport.size(); ++i)
+                    if (counts(i)) kept.push_back(transport[i]);
+                xport = summarize_transport(kept);
+            }
+            else xport = summarize_transport(transport);
+            xport->udp_sockets = raw_sockets.load();
+            xport->udp_workers = raw_async ? workers : 0;
+            xport->stray       = raw_stray.load();
+            if (!xport->responses) xport.reset();
+        }
+        std::optional<BusyPollSplit> busy;
+        if (opt.busy_poll >= 0)
+            busy = split_busy_poll(times, failed, phase, n_targets, opt.concurrency);
+        const std::vector<int> busy_pctl =
+                opt.pctl.empty() ? std::vector<int>{50, 90, 99} : opt.pctl;
+        std::optional<CacheSummary> cache;
+        if (opt.cache_stats && raw_mode)
+        {
+            // Classified over every attempt, since a warmup reply still
+            // fills the cache the later ones hit
+            auto cls = classify_cache(ttls, starts, times, n_targets);
+            if (partial)
+            {
+                std::vector<CacheClass> kept_cls;
+                for (size_t i = 0; i < cls.size(); ++i)
+                    if (counts(i)) kept_cls.push_back(cls[i]);
+                cache = summarize_cache(kept_cls, measured, pct_value(99));
+            }
+            else cache = summarize_cache(cls, times, pct_value(99));
+        }
         if (opt.json && !opt.ndjson)
         {
             // Emit JSON once at the end
@@ -1503,8 +8047,27 @@ int main(int argc, char **argv)
             os << "\"concurrency\":" << opt.concurrency << ",";
             os << "\"dedup\":" << (opt.dedup ? "true" : "false") << ",";
             os << R"("summary":{"min_ms":)" << minv << ",\"avg_ms\":" << avg <<
-                    ",\"max_ms\":" << maxv << ",\"count\":" << times.size() <<
+                    ",\"max_ms\":" << maxv << ",\"count\":" << mt.size() <<
                     "},";
+            if (warmup_hist.total)
+            {
+                os << "\"warmup\":{";
+                print_hist_json(warmup_hist, {}, os);
+                os << "},";
+            }
+            if (stability)
+                os << R"("stability":{"pctl":)" << opt.stable_pctl <<
+                        ",\"stable\":" << (stability->ok &&
+                                            stability->width_pct() <=
+                                            opt.stable_width
+                                                ? "true"
+                                                : "false") << ",\"ci\":[" <<
+                        stability->lo << "," << stability->hi <<
+                        "],\"width_pct\":" << stability->width_pct() <<
+                        ",\"target_pct\":" << opt.stable_width <<
+                        ",\"stopped_early\":" << (stop_run.load()
+                                                      ? "true"
+                                                      : "false") << "},";
             if (!opt.pctl.empty())
             {
                 os << "\"percentiles\":{";
@@ -1516,16 +8079,31 @@ int main(int argc, char **argv)
                 }
                 os << "},";
             }
+            if (ci)
+            {
+                print_ci_json(*ci, opt.pctl, os);
+                os << ",";
+            }
             os << "\"attempts\":[";
-            for (int i = 0; i < opt.tries; ++i)
+            bool first_attempt = true;
+            for (int i = 0; i < total; ++i)
             {
+                if (phase[i] == Phase::NotRun) continue;
                 const auto &[amt_ms, amt_rc, amt_error, amt_canon, amt_entries,
                     amt_ptrs] = attempts[i];
-                if (i) os << ",";
+                if (!first_attempt) os << ",";
+                first_attempt = false;
                 os << "{";
-                os << "\"try\":" << (i + 1) << ",\"ms\":" << amt_ms <<
-                        ",\"rc\":"
+                os << "\"try\":" << (i / n_targets + 1) << ",\"ms\":" << amt_ms
+                        << ",\"rc\":"
                         << amt_rc;
+                if (phase[i] == Phase::Warmup) os << R"(,"warmup":true)";
+                if (multi_host)
+                    os << R"(,"host":")" << json_escape(opt.hosts[i % n_hosts])
+                            << "\"";
+                if (!opt.ecs.empty())
+                    os << R"(,"ecs":")" << opt.ecs[i % n_targets / n_hosts].text
+                            << "\"";
                 if (!amt_error.empty())
                     os << R"(,"error":")" << json_escape(
                         amt_error) << "\"";
@@ -1571,17 +8149,221 @@ int main(int argc, char **argv)
                 os << "}";
             }
             os << "]";
+            if (multi_host)
+            {
+                os << ",\"hosts\":[";
+                for (int h = 0; h < n_hosts; ++h)
+                {
+                    const auto &hs = host_stats.hosts[h];
+                    if (h) os << ",";
+                    os << R"({"host":")" << json_escape(opt.hosts[h]) <<
+                            R"(","count":)" << hs.count << ",\"errors\":" << hs.
+                            errors << ",\"avg_ms\":" << hs.avg_ms() <<
+                            ",\"p50_ms\":" << hs.pct_ms(50) << ",\"p99_ms\":" <<
+                            hs.pct_ms(99) << "}";
+                }
+                os << "],\"slowest\":[";
+                auto slow = host_stats.slowest(opt.top_n);
+                for (size_t k = 0; k < slow.size(); ++k)
+                {
+                    if (k) os << ",";
+                    os << "\"" << json_escape(opt.hosts[slow[k]]) << "\"";
+                }
+                os << "]";
+            }
+            if (opt.answer_sets)
+            {
+                os << ",";
+                print_answer_sets_json(answer_sets[0],
+                                       targets,
+                                       opt.ecs.empty() ? "host" : "target",
+                                       os);
+            }
+            if (opt.nsid)
+            {
+                os << ",\"instances\":[";
+                bool first = true;
+                for (const auto &[id, is]: instances)
+                {
+                    if (!first) os << ",";
+                    first = false;
+                    os << R"({"nsid":")" << json_escape(id) << R"(","count":)"
+                            << is.count << ",\"errors\":" << is.errors <<
+                            ",\"avg_ms\":" << is.avg_ms() << ",\"p50_ms\":" <<
+                            is.pct_ms(50) << ",\"p99_ms\":" << is.pct_ms(99) <<
+                            "}";
+                }
+                os << "]";
+            }
+            if (!opt.ecs.empty())
+            {
+                os << ",\"subnets\":[";
+                for (size_t k = 0; k < opt.ecs.size(); ++k)
+                {
+                    const auto &ss = subnet_stats.hosts[k];
+                    if (k) os << ",";
+                    os << R"({"subnet":")" << opt.ecs[k].text <<
+                            R"(","count":)" << ss.count << ",\"errors\":" << ss.
+                            errors << ",\"avg_ms\":" << ss.avg_ms() <<
+                            ",\"p50_ms\":" << ss.pct_ms(50) << ",\"p99_ms\":" <<
+                            ss.pct_ms(99) << ",\"scope\":" << subnet_scope[k] <<
+                            "}";
+                }
+                os << "]";
+            }
+            if (!sources.empty())
+            {
+                os << ",\"sources\":[";
+                for (size_t k = 0; k < sources.size(); ++k)
+                {
+                    const auto &ss = source_stats.hosts[k];
+                    if (k) os << ",";
+                    os << R"({"source":")" << json_escape(sources[k].text) <<
+                            R"(","count":)" << ss.count << ",\"errors\":" << ss.
+                            errors << ",\"avg_ms\":" << ss.avg_ms() <<
+                            ",\"p50_ms\":" << ss.pct_ms(50) << ",\"p99_ms\":" <<
+                            ss.pct_ms(99) << "}";
+                }
+                os << "]";
+            }
+            if (cache)
+            {
+                os << ",";
+                print_cache_summary_json(*cache, os);
+            }
+            if (xport)
+            {
+                os << ",";
+                print_transport_json(*xport, os);
+            }
+            if (busy)
+            {
+                os << ",";
+                print_busy_poll_json(*busy, busy_pctl, opt.busy_poll, os);
+            }
             os << "}";
             std::print("{}\n", os.str());
         }
         else if (!opt.ndjson)
         {
+            if (opt.answer_sets) print_answer_sets(answer_sets[0], targets);
+            if (opt.nsid)
+            {
+                std::println("per-instance (NSID): {} instances",
+                             instances.size());
+                std::println("  {:<40} {:>7} {:>7} {:>10} {:>10}",
+                             "nsid",
+                             "count",
+                             "errors",
+                             "p50 ms",
+                             "p99 ms");
+                for (const auto &[id, is]: instances)
+                    std::println("  {:<40} {:>7} {:>7} {:>10.3f} {:>10.3f}",
+                                 id,
+                                 is.count,
+                                 is.errors,
+                                 is.pct_ms(50),
+                                 is.pct_ms(99));
+            }
+            if (!opt.ecs.empty())
+            {
+                std::println("per-subnet: {} subnets", opt.ecs.size());
+                std::println("  {:<43} {:>7} {:>7} {:>10} {:>10} {:>5}",
+                             "subnet",
+                             "count",
+                             "errors",
+                             "p50 ms",
+                             "p99 ms",
+                             "scope");
+                for (size_t k = 0; k < opt.ecs.size(); ++k)
+                {
+                    const auto &ss = subnet_stats.hosts[k];
+                    std::println(
+                        "  {:<43} {:>7} {:>7} {:>10.3f} {:>10.3f} {:>5}",
+                        opt.ecs[k].text,
+                        ss.count,
+                        ss.errors,
+                        ss.pct_ms(50),
+                        ss.pct_ms(99),
+                        subnet_scope[k] < 0
+                            ? std::string("-")
+                            : std::to_string(subnet_scope[k]));
+                }
+            }
+            if (!sources.empty())
+            {
+                std::println("per-source: {} sources", sources.size());
+                std::println("  {:<47} {:>7} {:>7} {:>10} {:>10}",
+                             "source",
+                             "count",
+                             "errors",
+                             "p50 ms",
+                             "p99 ms");
+                for (size_t k = 0; k < sources.size(); ++k)
+                {
+                    const auto &ss = source_stats.hosts[k];
+                    std::println("  {:<47} {:>7} {:>7} {:>10.3f} {:>10.3f}",
+                                 sources[k].text,
+                                 ss.count,
+                                 ss.errors,
+                                 ss.pct_ms(50),
+                                 ss.pct_ms(99));
+                }
+            }
+            if (cache) print_cache_summary(*cache);
+            if (xport) print_transport_summary(*xport);
+            if (busy) print_busy_poll_summary(*busy, busy_pctl);
+            if (multi_host && opt.per_host)
+            {
+                std::println("per-host: {} hosts", n_hosts);
+                std::println("  {:<40} {:>7} {:>7} {:>10} {:>10}",
+                             "host",
+                             "count",
+                             "errors",
+                             "p50 ms",
+                             "p99 ms");
+                for (int h = 0; h < n_hosts; ++h)
+                {
+                    const auto &hs = host_stats.hosts[h];
+                    std::println("  {:<40} {:>7} {:>7} {:>10.3f} {:>10.3f}",
+                                 opt.hosts[h],
+                                 hs.count,
+                                 hs.errors,
+                                 hs.pct_ms(50),
+                                 hs.pct_ms(99));
+                }
+            }
+            if (multi_host && opt.top_n > 0)
+            {
+                auto slow = host_stats.slowest(opt.top_n);
+                std::println("slowest {} of {} hosts by p99:",
+                             slow.size(),
+                             n_hosts);
+                for (size_t k = 0; k < slow.size(); ++k)
+                {
+                    const auto &hs = host_stats.hosts[slow[k]];
+                    std::println(
+                        "  {}. {}  p99={:.3f} ms  p50={:.3f} ms  count={}  errors={}",
+                        k + 1,
+                        opt.hosts[slow[k]],
+                        hs.pct_ms(99),
+                        hs.pct_ms(50),
+                        hs.count,
+                        hs.errors);
+                }
+            }
+            if (warmup_hist.total) print_warmup_summary(warmup_hist);
+            if (stability)
+                print_stability_summary(*stability,
+                                        opt,
+                                        stop_run.load(),
+                                        mt.size());
             std::println(
                 "summary: min={:.3f} ms, avg={:.3f} ms, max={:.3f} ms ({} tries)",
                 minv,
                 avg,
                 maxv,
-                times.size());
+                mt.size());
             if (!opt.pctl.empty())
             {
                 std::ostringstream os;
@@ -1596,6 +8378,7 @@ int main(int argc, char **argv)
                 }
                 std::println("{}", os.str());
             }
+            if (ci) print_ci_summary(*ci, opt.pctl);
         }
     }
 